@@ -0,0 +1,908 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <libavutil/avstring.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/time.h>
+#include "videoutils.h"
+
+/*
+ * player-bench: microbenchmarks of the player's building blocks.
+ *
+ * The test media is made here with libavcodec encoders, mpeg4 video and aac audio, and
+ * decoded again, so the packets and frames look like what the player gets from a file.
+ * Measured are the packet queue with producers and a consumer on it, sws_scale into a pool
+ * picture as in queue_picture, swr_convert into the device format as in audio_decode_frame,
+ * and the sync rule of video_refresh_timer, over sizes, formats and thread counts.
+ *
+ * Every benchmark runs -reps times and its result is the median run, a line
+ * "name<TAB>ns_per_op<TAB>ops_per_s", ns_per_op being the time of one operation on one thread.
+ * With -baseline the results are compared with an earlier run, a benchmark slower by more
+ * than -tolerance percent is a regression and the exit status 1.
+ * The picture pool is checked as well, a queue_picture that still allocates once the pool
+ * is warm fails the run with the exit status 1.
+ */
+#define BENCH_VIDEO_FRAMES 24
+#define BENCH_DECODED_FRAMES 8 //cycled through, more than the caches hold at 1080p
+#define BENCH_AUDIO_SECONDS 2
+#define BENCH_MAX_THREADS 16
+#define BENCH_MAX_RESULTS 512
+#define BENCH_MAX_REPS 32
+#define BENCH_QUEUE_PACKETS 200000
+#define BENCH_QUEUE_DEPTH 256 //producers back off above this, as the demuxer does
+#define BENCH_SYNC_CALLS 10000000
+#define BENCH_POOL_CONVERSIONS 200 //queue_picture calls checked after the warm-up
+#define BENCH_OUT_RATE 48000 //the device format of the player, s16 stereo
+#define BENCH_OUT_CHANNELS 2
+
+typedef struct BenchResult {
+    char name[128];
+    double ns_per_op;
+    double ops_per_s;
+}BenchResult;
+
+//the runs of one benchmark
+typedef struct BenchSamples {
+    double ns_per_op[BENCH_MAX_REPS];
+    double ops_per_s[BENCH_MAX_REPS];
+    int nb;
+}BenchSamples;
+
+typedef struct BenchVideo {
+    int width, height;
+    AVPacket *packets;
+    int nb_packets;
+    AVFrame *frames[BENCH_DECODED_FRAMES];
+    int nb_frames;
+}BenchVideo;
+
+typedef struct BenchAudio {
+    int sample_rate, channels;
+    AVFrame **frames;
+    int nb_frames;
+}BenchAudio;
+
+//what a worker thread of a conversion benchmark gets
+typedef struct BenchWorker {
+    AVFrame **frames;
+    int nb_frames;
+    volatile int *stop;
+    int64_t ops;
+    int failed;
+}BenchWorker;
+
+typedef struct BenchQueue {
+    PacketQueue queue;
+    BenchVideo *video;
+    SDL_atomic_t next; //packets handed out to the producers so far
+    int total;
+}BenchQueue;
+
+static BenchResult results[BENCH_MAX_RESULTS];
+static int nb_results = 0;
+static int64_t bench_time = 200000; //microseconds per run
+static int bench_reps = 5;
+static const char *bench_filter = NULL;
+
+static const int bench_sizes[][2] = { { 640, 360 }, { 1280, 720 }, { 1920, 1080 } };
+static const enum AVPixelFormat bench_pix_fmts[] = {
+    AV_PIX_FMT_YUV420P, AV_PIX_FMT_YUV422P, AV_PIX_FMT_NV12, AV_PIX_FMT_YUV420P10LE
+};
+static const enum AVSampleFormat bench_sample_fmts[] = {
+    AV_SAMPLE_FMT_FLTP, AV_SAMPLE_FMT_S16, AV_SAMPLE_FMT_S32P
+};
+static const int bench_rates[] = { 44100, 48000 };
+static const int bench_channels[] = { 2, 6 };
+static int bench_threads[] = { 1, 2, 4 };
+
+static int bench_selected(const char *name) {
+    return NULL == bench_filter || strstr(name, bench_filter) != NULL;
+}
+
+static void bench_add(const char *name, double ns_per_op, double ops_per_s) {
+    BenchResult *r;
+
+    if (nb_results == BENCH_MAX_RESULTS) {
+        return;
+    }
+    r = &results[nb_results++];
+    av_strlcpy(r->name, name, sizeof(r->name));
+    r->ns_per_op = ns_per_op;
+    r->ops_per_s = ops_per_s;
+    printf("%s\t%.1f\t%.1f\n", name, ns_per_op, ops_per_s);
+    fflush(stdout);
+}
+
+static void bench_sample(BenchSamples *samples, double ns_per_op, double ops_per_s) {
+    if (samples->nb < BENCH_MAX_REPS) {
+        samples->ns_per_op[samples->nb] = ns_per_op;
+        samples->ops_per_s[samples->nb] = ops_per_s;
+        samples->nb++;
+    }
+}
+
+/* The median run is the result, a run disturbed by the rest of the box only ever gets slower
+ * and no longer decides about a regression. */
+static void bench_add_median(const char *name, BenchSamples *samples) {
+    int order[BENCH_MAX_REPS];
+    int i, j;
+
+    if (samples->nb == 0) {
+        return;
+    }
+    for (i = 0; i < samples->nb; i++) {
+        for (j = i; j > 0 && samples->ns_per_op[order[j - 1]] > samples->ns_per_op[i]; j--) {
+            order[j] = order[j - 1];
+        }
+        order[j] = i;
+    }
+    i = order[(samples->nb - 1) / 2];
+    bench_add(name, samples->ns_per_op[i], samples->ops_per_s[i]);
+}
+
+//a moving gradient with some noise, so the encoder has something to spend bits on
+static void bench_fill_picture(AVFrame *frame, int index, uint32_t *seed) {
+    int x, y, p;
+
+    for (p = 0; p < 3; p++) {
+        int w = p ? frame->width / 2 : frame->width;
+        int h = p ? frame->height / 2 : frame->height;
+        for (y = 0; y < h; y++) {
+            uint8_t *row = frame->data[p] + y * frame->linesize[p];
+            for (x = 0; x < w; x++) {
+                *seed = *seed * 1664525 + 1013904223;
+                row[x] = (p ? 128 + ((x - y) >> 3) : x + y * 2 + index * 4) + (*seed >> 28);
+            }
+        }
+    }
+}
+
+static int bench_make_video(BenchVideo *video, int width, int height) {
+    AVCodec *encoder = avcodec_find_encoder(AV_CODEC_ID_MPEG4);
+    AVCodec *decoder = avcodec_find_decoder(AV_CODEC_ID_MPEG4);
+    AVCodecContext *enc = NULL, *dec = NULL;
+    AVFrame *frame = av_frame_alloc();
+    AVPacket packet;
+    uint32_t seed = 1;
+    int i, ret = -1;
+
+    memset(video, 0, sizeof(BenchVideo));
+    video->width = width;
+    video->height = height;
+    video->packets = av_mallocz_array(BENCH_VIDEO_FRAMES + 1, sizeof(AVPacket));
+    if (NULL == encoder || NULL == decoder || NULL == frame || NULL == video->packets) {
+        fprintf(stderr, "No mpeg4 codec to make the test video\n");
+        goto done;
+    }
+    enc = avcodec_alloc_context3(encoder);
+    dec = avcodec_alloc_context3(decoder);
+    if (NULL == enc || NULL == dec) {
+        goto done;
+    }
+    enc->width = width;
+    enc->height = height;
+    enc->pix_fmt = AV_PIX_FMT_YUV420P;
+    enc->time_base = (AVRational){ 1, 25 };
+    enc->gop_size = 12;
+    enc->bit_rate = (int64_t)width * height * 3;
+    if (avcodec_open2(enc, encoder, NULL) < 0 || avcodec_open2(dec, decoder, NULL) < 0) {
+        goto done;
+    }
+    frame->width = width;
+    frame->height = height;
+    frame->format = AV_PIX_FMT_YUV420P;
+    if (av_frame_get_buffer(frame, FRAME_POOL_ALIGN) < 0) {
+        goto done;
+    }
+
+    av_init_packet(&packet);
+    packet.data = NULL;
+    packet.size = 0;
+    for (i = 0; i <= BENCH_VIDEO_FRAMES; i++) {
+        if (i < BENCH_VIDEO_FRAMES) {
+            av_frame_make_writable(frame);
+            bench_fill_picture(frame, i, &seed);
+            frame->pts = i;
+            avcodec_send_frame(enc, frame);
+        } else {
+            avcodec_send_frame(enc, NULL);
+        }
+        while (video->nb_packets <= BENCH_VIDEO_FRAMES && avcodec_receive_packet(enc, &packet) == 0) {
+            av_packet_move_ref(&video->packets[video->nb_packets++], &packet);
+        }
+    }
+
+    //decoded again, the converters get real decoder output
+    for (i = 0; i <= video->nb_packets && video->nb_frames < BENCH_DECODED_FRAMES; i++) {
+        avcodec_send_packet(dec, i < video->nb_packets ? &video->packets[i] : NULL);
+        while (video->nb_frames < BENCH_DECODED_FRAMES && avcodec_receive_frame(dec, frame) == 0) {
+            video->frames[video->nb_frames++] = av_frame_clone(frame);
+            av_frame_unref(frame);
+        }
+    }
+    ret = video->nb_frames > 0 ? 0 : -1;
+
+    done:
+        av_frame_free(&frame);
+        avcodec_free_context(&enc);
+        avcodec_free_context(&dec);
+    return ret;
+}
+
+static int bench_make_audio(BenchAudio *audio, int sample_rate, int channels) {
+    AVCodec *encoder = avcodec_find_encoder(AV_CODEC_ID_AAC);
+    AVCodec *decoder = avcodec_find_decoder(AV_CODEC_ID_AAC);
+    AVCodecContext *enc = NULL, *dec = NULL;
+    AVFrame *frame = av_frame_alloc();
+    AVPacket packet;
+    int nb_input, max_frames, i, c, s, ret = -1;
+
+    memset(audio, 0, sizeof(BenchAudio));
+    audio->sample_rate = sample_rate;
+    audio->channels = channels;
+    if (NULL == encoder || NULL == decoder || NULL == frame) {
+        fprintf(stderr, "No aac codec to make the test audio\n");
+        goto done;
+    }
+    enc = avcodec_alloc_context3(encoder);
+    dec = avcodec_alloc_context3(decoder);
+    if (NULL == enc || NULL == dec) {
+        goto done;
+    }
+    enc->sample_fmt = AV_SAMPLE_FMT_FLTP;
+    enc->sample_rate = sample_rate;
+    enc->channels = channels;
+    enc->channel_layout = av_get_default_channel_layout(channels);
+    enc->bit_rate = 64000 * channels;
+    dec->sample_rate = sample_rate;
+    dec->channels = channels;
+    dec->channel_layout = enc->channel_layout;
+    if (avcodec_open2(enc, encoder, NULL) < 0) {
+        goto done;
+    }
+    //the decoder needs the stream header the encoder made
+    dec->extradata = av_mallocz(enc->extradata_size + AV_INPUT_BUFFER_PADDING_SIZE);
+    if (enc->extradata_size > 0 && dec->extradata) {
+        memcpy(dec->extradata, enc->extradata, enc->extradata_size);
+        dec->extradata_size = enc->extradata_size;
+    }
+    if (avcodec_open2(dec, decoder, NULL) < 0) {
+        goto done;
+    }
+
+    nb_input = BENCH_AUDIO_SECONDS * sample_rate / enc->frame_size;
+    max_frames = nb_input + 16;
+    audio->frames = av_mallocz_array(max_frames, sizeof(AVFrame *));
+    if (NULL == audio->frames) {
+        goto done;
+    }
+    frame->nb_samples = enc->frame_size;
+    frame->format = AV_SAMPLE_FMT_FLTP;
+    frame->channels = channels;
+    frame->channel_layout = enc->channel_layout;
+    frame->sample_rate = sample_rate;
+    if (av_frame_get_buffer(frame, 0) < 0) {
+        goto done;
+    }
+
+    av_init_packet(&packet);
+    packet.data = NULL;
+    packet.size = 0;
+    for (i = 0; i <= nb_input; i++) {
+        if (i < nb_input) {
+            av_frame_make_writable(frame);
+            //a tone per channel
+            for (c = 0; c < channels; c++) {
+                float *samples = (float *)frame->data[c];
+                for (s = 0; s < frame->nb_samples; s++) {
+                    double t = (double)(i * frame->nb_samples + s) / sample_rate;
+                    samples[s] = 0.5 * sin(2 * M_PI * (220 + 110 * c) * t);
+                }
+            }
+            frame->pts = (int64_t)i * frame->nb_samples;
+            avcodec_send_frame(enc, frame);
+        } else {
+            avcodec_send_frame(enc, NULL);
+        }
+        while (avcodec_receive_packet(enc, &packet) == 0) {
+            AVFrame *decoded = av_frame_alloc();
+            avcodec_send_packet(dec, &packet);
+            av_packet_unref(&packet);
+            while (decoded && audio->nb_frames < max_frames && avcodec_receive_frame(dec, decoded) == 0) {
+                audio->frames[audio->nb_frames++] = av_frame_clone(decoded);
+                av_frame_unref(decoded);
+            }
+            av_frame_free(&decoded);
+        }
+    }
+    ret = audio->nb_frames > 0 ? 0 : -1;
+
+    done:
+        av_frame_free(&frame);
+        avcodec_free_context(&enc);
+        avcodec_free_context(&dec);
+    return ret;
+}
+
+//the decoded test frames in another format, made once outside of the measurement
+static int bench_convert_pictures(BenchVideo *video, enum AVPixelFormat pix_fmt, AVFrame **out) {
+    struct SwsContext *sws_ctx = NULL;
+    int i;
+
+    for (i = 0; i < video->nb_frames; i++) {
+        AVFrame *src = video->frames[i];
+        if (pix_fmt == src->format) {
+            out[i] = av_frame_clone(src);
+            continue;
+        }
+        sws_ctx = sws_getCachedContext(sws_ctx, src->width, src->height, src->format,
+                                       src->width, src->height, pix_fmt, SWS_BILINEAR, NULL, NULL, NULL);
+        out[i] = av_frame_alloc();
+        if (NULL == sws_ctx || NULL == out[i]) {
+            sws_freeContext(sws_ctx);
+            return -1;
+        }
+        out[i]->width = src->width;
+        out[i]->height = src->height;
+        out[i]->format = pix_fmt;
+        if (av_frame_get_buffer(out[i], FRAME_POOL_ALIGN) < 0) {
+            sws_freeContext(sws_ctx);
+            return -1;
+        }
+        sws_scale(sws_ctx, (uint8_t const * const *)src->data, src->linesize, 0, src->height,
+                  out[i]->data, out[i]->linesize);
+    }
+    sws_freeContext(sws_ctx);
+    return 0;
+}
+
+static int bench_convert_samples(BenchAudio *audio, enum AVSampleFormat sample_fmt, AVFrame **out) {
+    int i;
+
+    for (i = 0; i < audio->nb_frames; i++) {
+        AVFrame *src = audio->frames[i];
+        struct SwrContext *swr_ctx;
+        if (sample_fmt == src->format) {
+            out[i] = av_frame_clone(src);
+            continue;
+        }
+        out[i] = av_frame_alloc();
+        swr_ctx = swr_alloc_set_opts(NULL, src->channel_layout, sample_fmt, src->sample_rate,
+                                     src->channel_layout, src->format, src->sample_rate, 0, NULL);
+        if (NULL == out[i] || NULL == swr_ctx || swr_init(swr_ctx) < 0) {
+            swr_free(&swr_ctx);
+            return -1;
+        }
+        out[i]->channel_layout = src->channel_layout;
+        out[i]->channels = src->channels;
+        out[i]->sample_rate = src->sample_rate;
+        out[i]->format = sample_fmt;
+        out[i]->nb_samples = src->nb_samples;
+        if (av_frame_get_buffer(out[i], 0) < 0 ||
+                swr_convert(swr_ctx, out[i]->data, out[i]->nb_samples,
+                            (const uint8_t **)src->data, src->nb_samples) < 0) {
+            swr_free(&swr_ctx);
+            return -1;
+        }
+        swr_free(&swr_ctx);
+    }
+    return 0;
+}
+
+static void bench_free_frames(AVFrame **frames, int nb_frames) {
+    int i;
+    for (i = 0; i < nb_frames; i++) {
+        av_frame_free(&frames[i]);
+    }
+}
+
+/* Run the worker on n threads for bench_time, returns the wall time in microseconds. */
+static int64_t bench_threads_run(int (*worker)(void *), BenchWorker *workers, int n, volatile int *stop) {
+    SDL_Thread *tids[BENCH_MAX_THREADS];
+    int64_t start;
+    int i;
+
+    *stop = 0;
+    start = av_gettime_relative();
+    for (i = 0; i < n; i++) {
+        workers[i].stop = stop;
+        tids[i] = SDL_CreateThread(worker, "bench_worker", &workers[i]);
+        if (NULL == tids[i]) {
+            workers[i].failed = 1;
+        }
+    }
+    av_usleep(bench_time);
+    *stop = 1;
+    for (i = 0; i < n; i++) {
+        if (tids[i]) {
+            SDL_WaitThread(tids[i], NULL);
+        }
+    }
+    return av_gettime_relative() - start;
+}
+
+/* bench_reps runs of the worker on n threads, the median run is the result. */
+static void bench_threads_measure(const char *name, int (*worker)(void *), BenchWorker *workers, int n,
+                                  volatile int *stop) {
+    BenchSamples samples;
+    int r, i;
+
+    memset(&samples, 0, sizeof(samples));
+    for (r = 0; r < bench_reps; r++) {
+        int64_t elapsed, ops = 0;
+        for (i = 0; i < n; i++) {
+            workers[i].ops = 0;
+            workers[i].failed = 0;
+        }
+        elapsed = bench_threads_run(worker, workers, n, stop);
+        for (i = 0; i < n; i++) {
+            if (workers[i].failed) {
+                fprintf(stderr, "%s: failed\n", name);
+                return;
+            }
+            ops += workers[i].ops;
+        }
+        if (ops > 0) {
+            bench_sample(&samples, elapsed * 1000.0 * n / ops, ops * 1000000.0 / elapsed);
+        }
+    }
+    bench_add_median(name, &samples);
+}
+
+/* queue_picture: a pool picture of the same size in YUV420P, the converter from the cache */
+static int bench_sws_worker(void *userdata) {
+    BenchWorker *w = (BenchWorker *)userdata;
+    ScalerCache scalers;
+    FramePool pool;
+    AVFrame *dst = av_frame_alloc();
+    int i = 0;
+
+    memset(&scalers, 0, sizeof(scalers));
+    memset(&pool, 0, sizeof(pool));
+    while (dst && !*w->stop) {
+        AVFrame *src = w->frames[i++ % w->nb_frames];
+        struct SwsContext *sws_ctx = scaler_cache_get(&scalers, src->width, src->height, src->format,
+                                                      src->width, src->height, AV_PIX_FMT_YUV420P);
+        if (NULL == sws_ctx || frame_pool_get(&pool, dst, src->width, src->height, AV_PIX_FMT_YUV420P) < 0) {
+            w->failed = 1;
+            break;
+        }
+        sws_scale(sws_ctx, (uint8_t const * const *)src->data, src->linesize, 0, src->height,
+                  dst->data, dst->linesize);
+        av_frame_unref(dst);
+        w->ops++;
+    }
+    av_frame_free(&dst);
+    frame_pool_uninit(&pool);
+    scaler_cache_free(&scalers);
+    return 0;
+}
+
+/* audio_decode_frame: straight into an AUDIO_BUF_SIZE buffer in the device format */
+static int bench_swr_worker(void *userdata) {
+    BenchWorker *w = (BenchWorker *)userdata;
+    AVFrame *first = w->frames[0];
+    uint8_t *buf = av_malloc(AUDIO_BUF_SIZE);
+    int room = AUDIO_BUF_SIZE / (BENCH_OUT_CHANNELS * 2);
+    struct SwrContext *swr_ctx;
+    int i = 0;
+
+    swr_ctx = swr_alloc_set_opts(NULL,
+                av_get_default_channel_layout(BENCH_OUT_CHANNELS), AV_SAMPLE_FMT_S16, BENCH_OUT_RATE,
+                first->channel_layout, first->format, first->sample_rate, 0, NULL);
+    if (NULL == buf || NULL == swr_ctx || swr_init(swr_ctx) < 0) {
+        w->failed = 1;
+    }
+    while (!w->failed && !*w->stop) {
+        AVFrame *src = w->frames[i++ % w->nb_frames];
+        if (swr_convert(swr_ctx, &buf, room, (const uint8_t **)src->data, src->nb_samples) < 0) {
+            w->failed = 1;
+            break;
+        }
+        w->ops++;
+    }
+    swr_free(&swr_ctx);
+    av_free(buf);
+    return 0;
+}
+
+static void bench_sws(BenchVideo *video) {
+    BenchWorker workers[BENCH_MAX_THREADS];
+    AVFrame *frames[BENCH_DECODED_FRAMES];
+    volatile int stop = 0;
+    char name[128];
+    int f, t, i;
+
+    for (f = 0; f < FF_ARRAY_ELEMS(bench_pix_fmts); f++) {
+        memset(frames, 0, sizeof(frames));
+        snprintf(name, sizeof(name), "sws_scale/%dx%d/%s", video->width, video->height,
+                 av_get_pix_fmt_name(bench_pix_fmts[f]));
+        if (!bench_selected(name)) {
+            continue;
+        }
+        if (bench_convert_pictures(video, bench_pix_fmts[f], frames) < 0) {
+            fprintf(stderr, "%s: could not make the source pictures\n", name);
+            bench_free_frames(frames, video->nb_frames);
+            continue;
+        }
+        for (t = 0; t < FF_ARRAY_ELEMS(bench_threads); t++) {
+            snprintf(name, sizeof(name), "sws_scale/%dx%d/%s/threads=%d", video->width, video->height,
+                     av_get_pix_fmt_name(bench_pix_fmts[f]), bench_threads[t]);
+            if (!bench_selected(name)) {
+                continue;
+            }
+            memset(workers, 0, sizeof(workers));
+            for (i = 0; i < bench_threads[t]; i++) {
+                workers[i].frames = frames;
+                workers[i].nb_frames = video->nb_frames;
+            }
+            bench_threads_measure(name, bench_sws_worker, workers, bench_threads[t], &stop);
+        }
+        bench_free_frames(frames, video->nb_frames);
+    }
+}
+
+/* queue_picture over a full picture queue: every slot gives its buffer back to the pool and
+ * takes one again, after the warm-up the pool must serve them all without allocating */
+static int bench_frame_pool_check(BenchVideo *video) {
+    AVFrame *slots[VIDEO_PICTURE_QUEUE_MAX];
+    ScalerCache scalers;
+    FramePool pool;
+    char name[128];
+    int warmup = VIDEO_PICTURE_QUEUE_MAX * 2;
+    int i, allocations = 0, ret = 0;
+
+    snprintf(name, sizeof(name), "frame_pool/%dx%d", video->width, video->height);
+    if (!bench_selected(name) || video->nb_frames <= 0) {
+        return 0;
+    }
+    memset(slots, 0, sizeof(slots));
+    memset(&scalers, 0, sizeof(scalers));
+    memset(&pool, 0, sizeof(pool));
+    for (i = 0; i < VIDEO_PICTURE_QUEUE_MAX; i++) {
+        slots[i] = av_frame_alloc();
+        if (NULL == slots[i]) {
+            ret = -1;
+            goto done;
+        }
+    }
+    for (i = 0; i < warmup + BENCH_POOL_CONVERSIONS; i++) {
+        AVFrame *src = video->frames[i % video->nb_frames];
+        AVFrame *dst = slots[i % VIDEO_PICTURE_QUEUE_MAX];
+        struct SwsContext *sws_ctx = scaler_cache_get(&scalers, src->width, src->height, src->format,
+                                                      src->width, src->height, AV_PIX_FMT_YUV420P);
+        if (i == warmup) {
+            allocations = frame_pool_allocations();
+        }
+        av_frame_unref(dst);
+        if (NULL == sws_ctx || frame_pool_get(&pool, dst, src->width, src->height, AV_PIX_FMT_YUV420P) < 0) {
+            ret = -1;
+            goto done;
+        }
+        sws_scale(sws_ctx, (uint8_t const * const *)src->data, src->linesize, 0, src->height,
+                  dst->data, dst->linesize);
+    }
+    allocations = frame_pool_allocations() - allocations;
+    if (allocations > 0) {
+        fprintf(stderr, "%s: %d picture buffers allocated after the warm-up\n", name, allocations);
+        ret = 1;
+    }
+
+    done:
+    if (ret < 0) {
+        fprintf(stderr, "%s: could not convert the pictures\n", name);
+    }
+    for (i = 0; i < VIDEO_PICTURE_QUEUE_MAX; i++) {
+        av_frame_free(&slots[i]);
+    }
+    frame_pool_uninit(&pool);
+    scaler_cache_free(&scalers);
+    return ret;
+}
+
+static void bench_swr(BenchAudio *audio) {
+    BenchWorker workers[BENCH_MAX_THREADS];
+    AVFrame **frames;
+    volatile int stop = 0;
+    char name[128];
+    int f, t, i;
+
+    frames = av_mallocz_array(audio->nb_frames, sizeof(AVFrame *));
+    if (NULL == frames) {
+        return;
+    }
+    for (f = 0; f < FF_ARRAY_ELEMS(bench_sample_fmts); f++) {
+        memset(frames, 0, audio->nb_frames * sizeof(AVFrame *));
+        snprintf(name, sizeof(name), "swr_convert/%s/%d/%dch", av_get_sample_fmt_name(bench_sample_fmts[f]),
+                 audio->sample_rate, audio->channels);
+        if (!bench_selected(name)) {
+            continue;
+        }
+        if (bench_convert_samples(audio, bench_sample_fmts[f], frames) < 0) {
+            fprintf(stderr, "%s: could not make the source samples\n", name);
+            bench_free_frames(frames, audio->nb_frames);
+            continue;
+        }
+        for (t = 0; t < FF_ARRAY_ELEMS(bench_threads); t++) {
+            snprintf(name, sizeof(name), "swr_convert/%s/%d/%dch/threads=%d",
+                     av_get_sample_fmt_name(bench_sample_fmts[f]), audio->sample_rate, audio->channels,
+                     bench_threads[t]);
+            if (!bench_selected(name)) {
+                continue;
+            }
+            memset(workers, 0, sizeof(workers));
+            for (i = 0; i < bench_threads[t]; i++) {
+                workers[i].frames = frames;
+                workers[i].nb_frames = audio->nb_frames;
+            }
+            bench_threads_measure(name, bench_swr_worker, workers, bench_threads[t], &stop);
+        }
+        bench_free_frames(frames, audio->nb_frames);
+    }
+    av_free(frames);
+}
+
+static int bench_queue_producer(void *userdata) {
+    BenchQueue *bq = (BenchQueue *)userdata;
+    int n;
+
+    while ((n = SDL_AtomicAdd(&bq->next, 1)) < bq->total) {
+        AVPacket packet;
+        av_init_packet(&packet);
+        packet.data = NULL;
+        packet.size = 0;
+        //unlocked read, as packet_queues_full does it
+        while (bq->queue.nb_packets > BENCH_QUEUE_DEPTH) {
+            sched_yield();
+        }
+        //a new reference of the payload, as av_read_frame hands one out
+        if (av_packet_ref(&packet, &bq->video->packets[n % bq->video->nb_packets]) < 0 ||
+                packet_queue_put(&bq->queue, &packet) < 0) {
+            av_packet_unref(&packet);
+        }
+    }
+    return 0;
+}
+
+/* producers put, as the demuxer does, one consumer gets and drops, as a decoder does.
+ * Returns the run time in microseconds, or -1 when not every producer could start. */
+static int64_t bench_queue_run(BenchVideo *video, int producers, int *received) {
+    SDL_Thread *tids[BENCH_MAX_THREADS];
+    BenchQueue bq;
+    AVPacket packet;
+    int i, started = 0, quit = 0;
+    int64_t start, elapsed;
+
+    memset(&bq, 0, sizeof(bq));
+    packet_queue_init(&bq.queue);
+    bq.video = video;
+    bq.total = BENCH_QUEUE_PACKETS;
+
+    start = av_gettime_relative();
+    for (i = 0; i < producers; i++) {
+        tids[i] = SDL_CreateThread(bench_queue_producer, "bench_producer", &bq);
+        if (tids[i]) {
+            started++;
+        }
+    }
+    //without a producer nothing would ever arrive, the started ones still put every packet
+    for (*received = 0; started > 0 && *received < bq.total; (*received)++) {
+        if (packet_queue_get(&bq.queue, &packet, 1, &quit) <= 0) {
+            break;
+        }
+        av_packet_unref(&packet);
+    }
+    elapsed = av_gettime_relative() - start;
+    for (i = 0; i < producers; i++) {
+        if (tids[i]) {
+            SDL_WaitThread(tids[i], NULL);
+        }
+    }
+    packet_queue_destroy(&bq.queue);
+    return started < producers || *received == 0 ? -1 : elapsed;
+}
+
+static void bench_queue(BenchVideo *video) {
+    BenchSamples samples;
+    char name[128];
+    int t, r, received;
+    int64_t elapsed;
+
+    for (t = 0; t < FF_ARRAY_ELEMS(bench_threads); t++) {
+        snprintf(name, sizeof(name), "packet_queue/%dx%d/producers=%d", video->width, video->height,
+                 bench_threads[t]);
+        if (!bench_selected(name)) {
+            continue;
+        }
+        memset(&samples, 0, sizeof(samples));
+        for (r = 0; r < bench_reps; r++) {
+            elapsed = bench_queue_run(video, bench_threads[t], &received);
+            if (elapsed < 0) {
+                fprintf(stderr, "%s: could not start the producers\n", name);
+                break;
+            }
+            //one put and one get per packet
+            bench_sample(&samples, elapsed * 1000.0 / received, received * 1000000.0 / elapsed);
+        }
+        if (r == bench_reps) {
+            bench_add_median(name, &samples);
+        }
+    }
+}
+
+static void bench_sync(void) {
+    volatile double sink = 0;
+    BenchSamples samples;
+    int64_t start, elapsed;
+    int i, r;
+
+    if (!bench_selected("video_sync_delay")) {
+        return;
+    }
+    memset(&samples, 0, sizeof(samples));
+    for (r = 0; r < bench_reps; r++) {
+        start = av_gettime_relative();
+        for (i = 0; i < BENCH_SYNC_CALLS; i++) {
+            //every branch: late, in sync, early with short and long frames
+            double delay = (i & 1) ? 0.04 : 0.2;
+            double diff = ((i % 97) - 48) * 0.005;
+            sink += video_sync_delay(delay, diff);
+        }
+        elapsed = av_gettime_relative() - start;
+        bench_sample(&samples, elapsed * 1000.0 / BENCH_SYNC_CALLS, BENCH_SYNC_CALLS * 1000000.0 / elapsed);
+    }
+    bench_add_median("video_sync_delay", &samples);
+}
+
+static int bench_write(const char *path) {
+    FILE *out = fopen(path, "w");
+    int i;
+
+    if (NULL == out) {
+        fprintf(stderr, "Could not write %s\n", path);
+        return -1;
+    }
+    fprintf(out, "#name\tns_per_op\tops_per_s\n");
+    for (i = 0; i < nb_results; i++) {
+        fprintf(out, "%s\t%.1f\t%.1f\n", results[i].name, results[i].ns_per_op, results[i].ops_per_s);
+    }
+    fclose(out);
+    return 0;
+}
+
+//number of regressions, benchmarks missing from either side are listed but do not count
+static int bench_compare(const char *path, double tolerance) {
+    FILE *in = fopen(path, "r");
+    char line[512], name[128];
+    double base;
+    int i, regressions = 0, compared = 0;
+
+    if (NULL == in) {
+        fprintf(stderr, "No baseline %s\n", path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), in)) {
+        char *tab = strchr(line, '\t');
+        if (line[0] == '#' || NULL == tab || tab - line >= (int)sizeof(name)) {
+            continue;
+        }
+        av_strlcpy(name, line, tab - line + 1);
+        base = atof(tab + 1);
+        for (i = 0; i < nb_results; i++) {
+            if (!strcmp(results[i].name, name)) {
+                break;
+            }
+        }
+        if (i == nb_results) {
+            if (bench_selected(name)) {
+                fprintf(stderr, "not run: %s\n", name);
+            }
+            continue;
+        }
+        compared++;
+        if (base > 0 && results[i].ns_per_op > base * (1 + tolerance / 100)) {
+            fprintf(stderr, "REGRESSION %s: %.1f ns -> %.1f ns (%+.1f%%)\n",
+                    name, base, results[i].ns_per_op, (results[i].ns_per_op / base - 1) * 100);
+            regressions++;
+        }
+    }
+    fclose(in);
+    fprintf(stderr, "%d benchmarks compared with %s, %d slower by more than %.0f%%\n",
+            compared, path, regressions, tolerance);
+    return regressions;
+}
+
+static void show_usage(void) {
+    fprintf(stderr, "usage:./player-bench [options]\n"
+                    "  -o file          write the results to file\n"
+                    "  -baseline file   compare with the results of an earlier run\n"
+                    "  -tolerance pct   slowdown still accepted against the baseline (default 10)\n"
+                    "  -filter str      only benchmarks whose name contains str\n"
+                    "  -time ms         time per run (default 200)\n"
+                    "  -reps N          runs per benchmark, the median run counts (default 5)\n"
+                    "  -threads N       thread counts 1, 2 and N (default 4)\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *output = NULL, *baseline = NULL;
+    double tolerance = 10;
+    BenchVideo video;
+    BenchAudio audio;
+    int i, j, ret = 0;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+            output = argv[++i];
+        } else if (!strcmp(argv[i], "-baseline") && i + 1 < argc) {
+            baseline = argv[++i];
+        } else if (!strcmp(argv[i], "-tolerance") && i + 1 < argc) {
+            tolerance = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-filter") && i + 1 < argc) {
+            bench_filter = argv[++i];
+        } else if (!strcmp(argv[i], "-time") && i + 1 < argc) {
+            bench_time = FFMAX(10, atoi(argv[++i])) * 1000LL;
+        } else if (!strcmp(argv[i], "-reps") && i + 1 < argc) {
+            bench_reps = av_clip(atoi(argv[++i]), 1, BENCH_MAX_REPS);
+        } else if (!strcmp(argv[i], "-threads") && i + 1 < argc) {
+            bench_threads[FF_ARRAY_ELEMS(bench_threads) - 1] = av_clip(atoi(argv[++i]), 3, BENCH_MAX_THREADS);
+        } else {
+            show_usage();
+            return 2;
+        }
+    }
+    av_log_set_level(AV_LOG_ERROR);
+
+    printf("#name\tns_per_op\tops_per_s\n");
+    bench_sync();
+    for (i = 0; i < FF_ARRAY_ELEMS(bench_sizes); i++) {
+        if (bench_make_video(&video, bench_sizes[i][0], bench_sizes[i][1]) < 0) {
+            fprintf(stderr, "Could not make the %dx%d test video\n", bench_sizes[i][0], bench_sizes[i][1]);
+            ret = 2;
+        } else {
+            int check;
+            bench_queue(&video);
+            bench_sws(&video);
+            check = bench_frame_pool_check(&video);
+            if (check < 0) {
+                ret = 2;
+            } else if (check > 0 && 0 == ret) {
+                ret = 1;
+            }
+        }
+        for (j = 0; j < video.nb_packets; j++) {
+            av_packet_unref(&video.packets[j]);
+        }
+        av_free(video.packets);
+        bench_free_frames(video.frames, video.nb_frames);
+    }
+    for (i = 0; i < FF_ARRAY_ELEMS(bench_rates); i++) {
+        for (j = 0; j < FF_ARRAY_ELEMS(bench_channels); j++) {
+            if (bench_make_audio(&audio, bench_rates[i], bench_channels[j]) < 0) {
+                fprintf(stderr, "Could not make the %d Hz %d channel test audio\n", bench_rates[i], bench_channels[j]);
+                ret = 2;
+            } else {
+                bench_swr(&audio);
+            }
+            bench_free_frames(audio.frames, audio.nb_frames);
+            av_free(audio.frames);
+        }
+    }
+
+    if (output && bench_write(output) < 0) {
+        ret = 2;
+    }
+    if (baseline) {
+        int regressions = bench_compare(baseline, tolerance);
+        if (regressions < 0) {
+            ret = 2;
+        } else if (regressions > 0 && 0 == ret) {
+            ret = 1;
+        }
+    }
+    return ret;
+}
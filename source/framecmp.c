@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+/*
+ * framehash-cmp: compare two -framehash outputs of the player.
+ *
+ * The streams are compared independently, in their own order, as audio and video lines
+ * are interleaved differently from run to run. Prints the first divergence of each
+ * stream, exits with 0 when both runs match, 1 when they differ, 2 on errors.
+ */
+#define FRAMECMP_STREAMS 2 //video and audio, numbered as in framehash.h
+
+typedef struct FrameLine {
+    double pts;
+    int64_t size;
+    uint64_t hash;
+}FrameLine;
+
+typedef struct FrameList {
+    FrameLine *lines;
+    int nb_lines, nb_alloc;
+}FrameList;
+
+static int frame_list_add(FrameList *list, const FrameLine *line) {
+    if (list->nb_lines == list->nb_alloc) {
+        int nb_alloc = list->nb_alloc ? list->nb_alloc * 2 : 1024;
+        FrameLine *lines = realloc(list->lines, nb_alloc * sizeof(FrameLine));
+        if (NULL == lines) {
+            return -1;
+        }
+        list->lines = lines;
+        list->nb_alloc = nb_alloc;
+    }
+    list->lines[list->nb_lines++] = *line;
+    return 0;
+}
+
+static int read_hashes(const char *path, FrameList *streams) {
+    FILE *in = fopen(path, "r");
+    char buf[256];
+    int lineno = 0;
+
+    if (NULL == in) {
+        fprintf(stderr, "Could not open %s\n", path);
+        return -1;
+    }
+    while (fgets(buf, sizeof(buf), in)) {
+        FrameLine line;
+        int stream;
+        lineno++;
+        if (buf[0] == '#' || buf[0] == '\n') {
+            continue;
+        }
+        if (sscanf(buf, "%d, %lf, %"SCNd64", %"SCNx64, &stream, &line.pts, &line.size, &line.hash) != 4 ||
+                stream < 0 || stream >= FRAMECMP_STREAMS) {
+            fprintf(stderr, "%s:%d: not a frame hash line\n", path, lineno);
+            fclose(in);
+            return -1;
+        }
+        if (frame_list_add(&streams[stream], &line) < 0) {
+            fclose(in);
+            return -1;
+        }
+    }
+    fclose(in);
+    return 0;
+}
+
+static int compare_stream(int stream, const FrameList *a, const FrameList *b) {
+    static const char *names[FRAMECMP_STREAMS] = { "video", "audio" };
+    int n = a->nb_lines < b->nb_lines ? a->nb_lines : b->nb_lines;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        const FrameLine *la = &a->lines[i], *lb = &b->lines[i];
+        if (la->hash != lb->hash || la->size != lb->size || la->pts != lb->pts) {
+            printf("%s: first divergence at frame %d\n"
+                   "  a: pts %.6f, size %"PRId64", hash %016"PRIx64"\n"
+                   "  b: pts %.6f, size %"PRId64", hash %016"PRIx64"\n",
+                   names[stream], i, la->pts, la->size, la->hash, lb->pts, lb->size, lb->hash);
+            return 1;
+        }
+    }
+    if (a->nb_lines != b->nb_lines) {
+        printf("%s: identical for %d frames, then a has %d and b has %d\n",
+               names[stream], n, a->nb_lines, b->nb_lines);
+        return 1;
+    }
+    printf("%s: %d frames identical\n", names[stream], n);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    FrameList a[FRAMECMP_STREAMS], b[FRAMECMP_STREAMS];
+    int i, ret = 0;
+
+    if (argc != 3) {
+        fprintf(stderr, "usage:./framehash-cmp a.framehash b.framehash\n");
+        return 2;
+    }
+    memset(a, 0, sizeof(a));
+    memset(b, 0, sizeof(b));
+    if (read_hashes(argv[1], a) < 0 || read_hashes(argv[2], b) < 0) {
+        ret = 2;
+        goto done;
+    }
+    for (i = 0; i < FRAMECMP_STREAMS; i++) {
+        ret |= compare_stream(i, &a[i], &b[i]);
+    }
+
+    done:
+        for (i = 0; i < FRAMECMP_STREAMS; i++) {
+            free(a[i].lines);
+            free(b[i].lines);
+        }
+    return ret;
+}
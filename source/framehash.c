@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <libavutil/time.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/imgutils.h>
+#include "framehash.h"
+
+/* XXH64. Four independent lanes per 32 byte stripe, so the multiplies of one stripe
+ * overlap and the compiler can keep the lanes in vector registers. Reads are little
+ * endian, like every host the player runs on. */
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+typedef struct FrameHashOutput {
+    FILE *out;
+    int64_t video_time, audio_time; //microseconds spent hashing, each on its own thread
+    int nb_video, nb_audio;
+}FrameHashOutput;
+
+static FrameHashOutput output;
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static inline uint64_t xxh64_merge_round(uint64_t acc, uint64_t val) {
+    acc ^= xxh64_round(0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+static const uint8_t *xxh64_stripes(uint64_t *v, const uint8_t *p, const uint8_t *end) {
+    uint64_t v1 = v[0], v2 = v[1], v3 = v[2], v4 = v[3];
+    while (p + 32 <= end) {
+        v1 = xxh64_round(v1, read64(p));
+        v2 = xxh64_round(v2, read64(p + 8));
+        v3 = xxh64_round(v3, read64(p + 16));
+        v4 = xxh64_round(v4, read64(p + 24));
+        p += 32;
+    }
+    v[0] = v1;
+    v[1] = v2;
+    v[2] = v3;
+    v[3] = v4;
+    return p;
+}
+
+void framehash_init(FrameHashState *state) {
+    memset(state, 0, sizeof(FrameHashState));
+    state->v[0] = PRIME64_1 + PRIME64_2;
+    state->v[1] = PRIME64_2;
+    state->v[2] = 0;
+    state->v[3] = -PRIME64_1;
+}
+
+void framehash_update(FrameHashState *state, const uint8_t *data, size_t len) {
+    const uint8_t *end = data + len;
+
+    state->total_len += len;
+    if (state->mem_size + len < 32) {
+        memcpy(state->mem + state->mem_size, data, len);
+        state->mem_size += len;
+        return;
+    }
+    if (state->mem_size) {
+        int fill = 32 - state->mem_size;
+        memcpy(state->mem + state->mem_size, data, fill);
+        xxh64_stripes(state->v, state->mem, state->mem + 32);
+        data += fill;
+        state->mem_size = 0;
+    }
+    data = xxh64_stripes(state->v, data, end);
+    if (data < end) {
+        memcpy(state->mem, data, end - data);
+        state->mem_size = end - data;
+    }
+}
+
+uint64_t framehash_digest(const FrameHashState *state) {
+    const uint8_t *p = state->mem;
+    const uint8_t *end = p + state->mem_size;
+    uint64_t h;
+
+    if (state->total_len >= 32) {
+        h = rotl64(state->v[0], 1) + rotl64(state->v[1], 7) +
+            rotl64(state->v[2], 12) + rotl64(state->v[3], 18);
+        h = xxh64_merge_round(h, state->v[0]);
+        h = xxh64_merge_round(h, state->v[1]);
+        h = xxh64_merge_round(h, state->v[2]);
+        h = xxh64_merge_round(h, state->v[3]);
+    } else {
+        h = PRIME64_5;
+    }
+    h += state->total_len;
+
+    for (; p + 8 <= end; p += 8) {
+        h ^= xxh64_round(0, read64(p));
+        h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+    }
+    if (p + 4 <= end) {
+        h ^= (uint64_t)read32(p) * PRIME64_1;
+        h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h ^= (*p) * PRIME64_5;
+        h = rotl64(h, 11) * PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+int framehash_open(const char *path) {
+    output.out = strcmp(path, "-") ? fopen(path, "w") : stdout;
+    if (NULL == output.out) {
+        fprintf(stderr, "Could not open %s for the frame hashes\n", path);
+        return -1;
+    }
+    fprintf(output.out, "#format: frame hashes\n#hash: XXH64\n#stream, pts, size, hash\n");
+    return 0;
+}
+
+int framehash_enabled(void) {
+    return output.out != NULL;
+}
+
+void framehash_video(const AVFrame *frame, double pts) {
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(frame->format);
+    FrameHashState state;
+    int linesizes[4];
+    int64_t start = av_gettime_relative();
+    int64_t size = 0;
+    int p, y;
+
+    if (NULL == output.out || NULL == desc ||
+            av_image_fill_linesizes(linesizes, frame->format, frame->width) < 0) {
+        return;
+    }
+
+    framehash_init(&state);
+    for (p = 0; p < 4 && frame->data[p]; p++) {
+        int h = frame->height;
+        if (p == 1 || p == 2) {
+            h = -((-h) >> desc->log2_chroma_h);
+        }
+        for (y = 0; y < h; y++) {
+            framehash_update(&state, frame->data[p] + y * frame->linesize[p], linesizes[p]);
+        }
+        size += (int64_t)linesizes[p] * h;
+    }
+
+    fprintf(output.out, "%d, %.6f, %"PRId64", %016"PRIx64"\n",
+            FRAMEHASH_STREAM_VIDEO, pts, size, framehash_digest(&state));
+    output.nb_video++;
+    output.video_time += av_gettime_relative() - start;
+}
+
+void framehash_audio(const uint8_t *buf, int size, double pts) {
+    FrameHashState state;
+    int64_t start = av_gettime_relative();
+
+    if (NULL == output.out) {
+        return;
+    }
+    framehash_init(&state);
+    framehash_update(&state, buf, size);
+    fprintf(output.out, "%d, %.6f, %d, %016"PRIx64"\n",
+            FRAMEHASH_STREAM_AUDIO, pts, size, framehash_digest(&state));
+    output.nb_audio++;
+    output.audio_time += av_gettime_relative() - start;
+}
+
+void framehash_close(void) {
+    if (NULL == output.out) {
+        return;
+    }
+    fprintf(stderr, "frame hashes: %d pictures, %d audio blocks, %.2f ms hashing\n",
+            output.nb_video, output.nb_audio, (output.video_time + output.audio_time) / 1000.0);
+    if (output.out != stdout) {
+        fclose(output.out);
+    } else {
+        fflush(stdout);
+    }
+    output.out = NULL;
+}
@@ -0,0 +1,44 @@
+#ifndef FRAMEHASH_H
+#define FRAMEHASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <libavutil/frame.h>
+
+/* Per frame checksums of what the player presents, one line per displayed picture and
+ * per decoded audio block, in the spirit of ffmpeg's framemd5 muxer:
+ *
+ *     #stream, pts, size, hash
+ *     0, 1.040000, 115200, 3f0c9d1e5b7a2c44
+ *
+ * Stream 0 is video, stream 1 audio. The two streams are written from different threads,
+ * only the order within a stream is meaningful. The hash is XXH64, seed 0. */
+#define FRAMEHASH_STREAM_VIDEO 0
+#define FRAMEHASH_STREAM_AUDIO 1
+
+typedef struct FrameHashState {
+    uint64_t v[4];
+    uint64_t total_len;
+    uint8_t mem[32]; //tail not yet consumed by a full stripe
+    int mem_size;
+}FrameHashState;
+
+void framehash_init(FrameHashState *state);
+
+void framehash_update(FrameHashState *state, const uint8_t *data, size_t len);
+
+uint64_t framehash_digest(const FrameHashState *state);
+
+//"-" writes to stdout
+int framehash_open(const char *path);
+
+int framehash_enabled(void);
+
+//hashes the visible part of every plane, padding is skipped
+void framehash_video(const AVFrame *frame, double pts);
+
+void framehash_audio(const uint8_t *buf, int size, double pts);
+
+void framehash_close(void);
+
+#endif
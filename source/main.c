@@ -5,35 +5,78 @@
 #include <libavformat/avformat.h>
 #include <libavutil/avstring.h>
 #include <libavutil/time.h>
+#include <libavutil/channel_layout.h>
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_thread.h>
 #include <libswscale/swscale.h>
 #include <libswresample/swresample.h>
 #include "videoutils.h"
+#include "framehash.h"
+#include "threadsched.h"
+#include "trace.h"
+#include "waveform.h"
 
 
 #define SDL_AUDIO_BUFFER_SIZE 1024
 #define MAX_AUDIOQ_SIZE (5 * 16 * 1024)
 #define MAX_VIDEOQ_SIZE (5 * 256 * 1025)
-#define AV_NOSYNC_THRESHOLD 10.0
-#define AV_SYNC_THRESHOLD_MIN 0.04
-#define AV_SYNC_THRESHOLD_MAX 0.1
-/* If a frame duration is longer than this, it will not be duplicated(means add diff to delay, instead to 2 * delay) to compensate AV sync */
-#define AV_SYNC_FRAMEDUP_THRESHOLD 0.1
+
+/* live mode: small buffers everywhere, and catch up when the buffered latency grows */
+#define LIVE_AUDIO_BUFFER_SIZE 256
+#define LIVE_MAX_AUDIOQ_SIZE (16 * 1024)
+#define LIVE_MAX_VIDEOQ_SIZE (256 * 1024)
+/* above the target, audio is played LIVE_SPEEDUP faster (video follows the audio clock) */
+#define LIVE_LATENCY_TARGET 0.12
+#define LIVE_SPEEDUP 0.05
+/* above the max, queued audio packets are dropped and late pictures are skipped */
+#define LIVE_LATENCY_MAX 0.4
+
+/* over the memory budget the packet queues stop growing, but keep this many packets */
+#define BUDGET_MIN_QUEUE_PACKETS 8
+/* and the picture queue holds at most this many pictures */
+#define BUDGET_MAX_PICTURES 2
 
 static uint32_t FF_QUIT_EVENT = 0;
 static uint32_t FF_REFRESH_EVENT = 0;
 static uint32_t FF_ALLOC_EVENT = 0;
+static uint32_t FF_WAKEUP_EVENT = 0; //no action, the loop polls the trace and the stats
 
-static int audio_out_linesize = -1;
 static AVFrame *audioFrame = NULL;
 static int audio_channels = 0;
-static uint8_t *out_buffer = NULL;
 static SDL_Window *sdlWindow = NULL;
 static SDL_Renderer *renderer = NULL;
 static SDL_Texture *texture = NULL;
+static int texture_width = 0, texture_height = 0;
 static SDL_mutex *sdlWindow_alloc_mutex = NULL;
 static SDL_cond *sdlWindow_alloc_cond = NULL;
+static int audio_hw_freq = 0;
+
+//command line options
+static const char *input_filename = NULL;
+static char **input_files = NULL;
+static int nb_input_files = 0;
+static ThumbnailOptions thumb_opts = { 0, 320, 4, 0, "." };
+static MosaicOptions mosaic_opts = { 0, 384, 0, 0, 0, 0 };
+static ProbeOptions probe_opts = { 0, "probe.cache" };
+static int probe_mode = 0;
+static const char *decoder_threads = "auto";
+static const char *framehash_path = NULL;
+static const char *trace_path = NULL;
+static int stats_export = 0;
+static int bench_mode = 0;
+static int discard_unused = 1;
+static int waveform_enabled = 1;
+static int show_waveform = 1;
+static SDL_Rect waveform_rect; //where the overview was last drawn, for clicks
+static int wanted_audio_stream = -1;
+static int wanted_video_stream = -1;
+static int live_mode = 0;
+static int max_audioq_size = MAX_AUDIOQ_SIZE;
+static int max_videoq_size = MAX_VIDEOQ_SIZE;
+static int audio_buffer_samples = SDL_AUDIO_BUFFER_SIZE;
+static int audio_hw_buf_size = 0;
+static int pictq_depth = VIDEO_PICTURE_QUEUE_SIZE;
+static int use_hugepages = 0;
 
 VideoState *global_video_state;
 
@@ -50,15 +93,177 @@ void stream_component_close(VideoState *vs, enum AVMediaType type);
 int allocate_sdlwindow(void *userdata);
 double get_audio_clock(VideoState *vs);
 double synchronize_video(VideoState *vs, AVFrame *src_frame, double pts);
-void stream_seek(VideoState *is, int64_t pos, int rel);
-int open_codec_context(VideoState *vs, int *stream_idx, AVCodecContext **dec_ctx, enum AVMediaType type);
+void stream_cycle_audio(VideoState *vs);
+static void stream_switch_audio(VideoState *vs);
+static void discard_stream_type(AVFormatContext *fmt_ctx, enum AVMediaType type);
+static struct SwrContext *audio_open_resampler(AVCodecContext *codecCtx);
+static void bench_account(VideoState *vs, const AVPacket *pkt, int used);
+static void bench_report(VideoState *vs, int final);
+static double get_live_latency(VideoState *vs);
+static void live_report(VideoState *vs, int final);
+
+static void toggle_pause(VideoState *vs);
+static int demux_should_park(VideoState *vs);
+static int packet_queues_full(VideoState *vs);
+static void step_to_next_frame(VideoState *vs);
+
+static void show_usage(void) {
+    fprintf(stderr, "usage:./tutorial-sdl2-player [options] videoFileName\n"
+                    "       ./tutorial-sdl2-player -thumbs N [options] videoFileName...\n"
+                    "       ./tutorial-sdl2-player -mosaic N [options] videoFileName...\n"
+                    "       ./tutorial-sdl2-player -probe [options] videoFileName...\n"
+                    "  -bench        print demux throughput (packets/s, bytes/s) per second\n"
+                    "  -nodiscard    demux every stream, not only the played ones\n"
+                    "  -nowaveform   no waveform overview (w toggles it, a click on it seeks)\n"
+                    "  -ast index    play the audio stream with this index\n"
+                    "  -vst index    play the video stream with this index\n"
+                    "  -live         low latency mode for real time sources\n"
+                    "  -membudget MB cap the memory of queues and buffers, queues shrink to fit\n"
+                    "  -pictq N      decoded pictures queued ahead of display (1-%d, default %d)\n"
+                    "  -hugepages    back picture buffers with transparent huge pages\n"
+                    "  -framehash f  headless, write a hash per displayed picture and audio block to f (- for stdout)\n"
+                    "  -trace file   record a Chrome trace of the pipeline to file (SIGUSR1 toggles it at runtime)\n"
+                    "  -stats        publish live statistics in shared memory, read them with player-stats\n"
+                    "  -thread spec  role:key=value:..., roles demux video audio present timer decoder waveform,\n"
+                    "                keys cpus=0-1,3 fifo=prio nice=n name=str\n"
+                    "  -schedlat     measure thread wakeup latency before and after -thread settings\n"
+                    "  -thumbs N     no playback, write N keyframe thumbnails and a contact sheet per file\n"
+                    "  -thumbwidth W thumbnail width (default 320)\n"
+                    "  -thumbcols C  contact sheet columns (default 4)\n"
+                    "  -threads N    thumbnail, probe or -pool workers (default one per cpu)\n"
+                    "  -o dir        thumbnail output directory (default .)\n"
+                    "  -mosaic N     play the files in N tiles of one window, repeated to fill them\n"
+                    "  -tilewidth W  mosaic tile width (default 384)\n"
+                    "  -mosaiccols C mosaic columns (default square)\n"
+                    "  -pool         run the mosaic pipelines as tasks on one work stealing pool\n"
+                    "  -t seconds    stop the mosaic after this time and print the summary\n"
+                    "  -probe        no playback, print the streams of every file as JSON\n"
+                    "  -probecache f probe results cached by path, size and mtime (default probe.cache, none to disable)\n",
+                    VIDEO_PICTURE_QUEUE_MAX, VIDEO_PICTURE_QUEUE_SIZE);
+}
+
+static int parse_options(int argc, char *argv[]) {
+    int i;
+    input_files = av_mallocz_array(argc, sizeof(char *));
+    if (NULL == input_files) {
+        return -1;
+    }
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-bench")) {
+            bench_mode = 1;
+        } else if (!strcmp(argv[i], "-live")) {
+            live_mode = 1;
+            max_audioq_size = LIVE_MAX_AUDIOQ_SIZE;
+            max_videoq_size = LIVE_MAX_VIDEOQ_SIZE;
+            audio_buffer_samples = LIVE_AUDIO_BUFFER_SIZE;
+        } else if (!strcmp(argv[i], "-membudget") && i + 1 < argc) {
+            mem_budget_set_cap((int64_t)(atof(argv[++i]) * 1024 * 1024));
+        } else if (!strcmp(argv[i], "-pictq") && i + 1 < argc) {
+            pictq_depth = av_clip(atoi(argv[++i]), 1, VIDEO_PICTURE_QUEUE_MAX);
+        } else if (!strcmp(argv[i], "-hugepages")) {
+            use_hugepages = 1;
+        } else if (!strcmp(argv[i], "-nodiscard")) {
+            discard_unused = 0;
+        } else if (!strcmp(argv[i], "-nowaveform")) {
+            waveform_enabled = 0;
+        } else if (!strcmp(argv[i], "-ast") && i + 1 < argc) {
+            wanted_audio_stream = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-vst") && i + 1 < argc) {
+            wanted_video_stream = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-framehash") && i + 1 < argc) {
+            framehash_path = argv[++i];
+        } else if (!strcmp(argv[i], "-trace") && i + 1 < argc) {
+            trace_path = argv[++i];
+        } else if (!strcmp(argv[i], "-stats")) {
+            stats_export = 1;
+        } else if (!strcmp(argv[i], "-thread") && i + 1 < argc) {
+            if (thread_sched_parse(argv[++i]) < 0) {
+                return -1;
+            }
+        } else if (!strcmp(argv[i], "-schedlat")) {
+            thread_sched_set_probe(1);
+        } else if (!strcmp(argv[i], "-thumbs") && i + 1 < argc) {
+            thumb_opts.count = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-thumbwidth") && i + 1 < argc) {
+            thumb_opts.width = FFMAX(16, atoi(argv[++i]));
+        } else if (!strcmp(argv[i], "-thumbcols") && i + 1 < argc) {
+            thumb_opts.columns = FFMAX(1, atoi(argv[++i]));
+        } else if (!strcmp(argv[i], "-threads") && i + 1 < argc) {
+            thumb_opts.threads = atoi(argv[++i]);
+            mosaic_opts.threads = thumb_opts.threads;
+            probe_opts.threads = thumb_opts.threads;
+        } else if (!strcmp(argv[i], "-mosaic") && i + 1 < argc) {
+            mosaic_opts.count = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-tilewidth") && i + 1 < argc) {
+            mosaic_opts.tile_width = FFMAX(32, atoi(argv[++i]));
+        } else if (!strcmp(argv[i], "-mosaiccols") && i + 1 < argc) {
+            mosaic_opts.columns = FFMAX(1, atoi(argv[++i]));
+        } else if (!strcmp(argv[i], "-pool")) {
+            mosaic_opts.pool = 1;
+        } else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            mosaic_opts.duration = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-probe")) {
+            probe_mode = 1;
+        } else if (!strcmp(argv[i], "-probecache") && i + 1 < argc) {
+            probe_opts.cache_path = strcmp(argv[i + 1], "none") ? argv[i + 1] : NULL;
+            i++;
+        } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+            thumb_opts.output_dir = argv[++i];
+        } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            fprintf(stderr, "unknown option: %s\n", argv[i]);
+            return -1;
+        } else {
+            //only thumbnail, mosaic and probe mode take more than one, the player plays the first
+            if (nb_input_files == 0) {
+                input_filename = argv[i];
+            }
+            input_files[nb_input_files++] = argv[i];
+        }
+    }
+    return input_filename ? 0 : -1;
+}
 
 int main (int argc, char *argv[]) {
-    if (argc < 2) {
-        fprintf(stderr, "usage:./tutorial-sdl2-player videoFileName\n");
+    if (parse_options(argc, argv) < 0) {
+        show_usage();
         return -1;
     }
-    if (SDL_Init(SDL_INIT_EVERYTHING) != 0) {
+    if (probe_mode) {
+        return probe_run(input_files, nb_input_files, &probe_opts) < 0 ? -1 : 0;
+    }
+    if (thumb_opts.count > 0) {
+        //the workers already keep every cpu busy, one decoder thread each
+        decoder_threads = "1";
+        return thumbnail_run(input_files, nb_input_files, &thumb_opts) < 0 ? -1 : 0;
+    }
+    if (framehash_path) {
+        if (framehash_open(framehash_path) < 0) {
+            return -1;
+        }
+        //same pipeline and timing as normal playback, nothing on screen or speakers
+        SDL_setenv("SDL_VIDEODRIVER", "dummy", 1);
+        SDL_setenv("SDL_AUDIODRIVER", "dummy", 1);
+        //a frame threaded decoder holds frames back and its timing decides which pictures are late
+        decoder_threads = "1";
+    }
+    trace_init(trace_path, trace_path != NULL);
+    if (mosaic_opts.count > 0) {
+        int ret;
+        //one pipeline per tile, once they outnumber the cpus more decoder threads only contend,
+        //on the pool the workers are all the threads there are
+        if (mosaic_opts.pool || mosaic_opts.count >= SDL_GetCPUCount()) {
+            decoder_threads = "1";
+        }
+        ret = mosaic_run(input_files, nb_input_files, &mosaic_opts);
+        trace_uninit();
+        thread_sched_report(stderr);
+        return ret < 0 ? -1 : 0;
+    }
+    if (stats_export && stats_open(NULL) < 0) {
+        stats_export = 0;
+    }
+    //video, timers and audio are brought up once the file is known to need them
+    if (SDL_Init(SDL_INIT_EVENTS) != 0) {
         fprintf(stderr, "SDL_Init Error:%s", SDL_GetError());
         return -1;
     }
@@ -67,7 +272,7 @@ int main (int argc, char *argv[]) {
     sdlWindow_alloc_mutex = SDL_CreateMutex();
     sdlWindow_alloc_cond = SDL_CreateCond();
 
-    FF_QUIT_EVENT = SDL_RegisterEvents(3);
+    FF_QUIT_EVENT = SDL_RegisterEvents(4);
     if (FF_QUIT_EVENT == ((Uint32) - 1))
     {
         //not enough user-defined events left, reset to zero
@@ -75,26 +280,34 @@ int main (int argc, char *argv[]) {
     }
     FF_REFRESH_EVENT = FF_QUIT_EVENT + 1;
     FF_ALLOC_EVENT = FF_QUIT_EVENT + 2;
+    FF_WAKEUP_EVENT = FF_QUIT_EVENT + 3;
+    trace_set_wakeup(FF_WAKEUP_EVENT);
+    if (stats_export && stats_start_timer(FF_WAKEUP_EVENT) < 0) {
+        fprintf(stderr, "No stats timer, the stats are only updated during playback\n");
+    }
 
     //video state init
     VideoState *vs;
     vs = av_mallocz(sizeof(VideoState));
-    av_strlcpy(vs->filename, argv[1], sizeof(vs->filename));
+    av_strlcpy(vs->filename, input_filename, sizeof(vs->filename));
     vs->pictq_mutex = SDL_CreateMutex();
     vs->pictq_cond = SDL_CreateCond();
+    vs->pictq_write_mutex = SDL_CreateMutex();
+    vs->pause_mutex = SDL_CreateMutex();
+    vs->pause_cond = SDL_CreateCond();
     vs->quit = 0;
-    vs->videoStreamIndex = -1;
-    vs->audioStreamIndex = -1;
+    vs->videoStreamIndex = wanted_video_stream;
+    vs->audioStreamIndex = wanted_audio_stream;
     int pictq_index = 0;
-    for (pictq_index = 0; pictq_index < VIDEO_PICTURE_QUEUE_SIZE; pictq_index++) {
+    for (pictq_index = 0; pictq_index < VIDEO_PICTURE_QUEUE_MAX; pictq_index++) {
         vs->pict_q[pictq_index].pictYUV = NULL;
     }
+    vs->pictq_depth = pictq_depth;
+    vs->picture_pool.hugepages = use_hugepages;
     //flush packet init
     av_init_packet(&flush_pkt);
     flush_pkt.data= (unsigned char *)("FLUSH");
 
-    schedule_refresh(vs, 40);
-
     vs->parse_tid = SDL_CreateThread(decode_thread, "decode_thread", vs);
     if (!vs->parse_tid) {
         av_free(vs);
@@ -103,12 +316,21 @@ int main (int argc, char *argv[]) {
 
     SDL_Event event;
     SDL_zero(event);
+    thread_sched_enter(THREAD_PRESENT);
+    trace_thread_name("present");
     for(;;) {
         double incr,pos;
         incr=pos=0;
-        SDL_WaitEvent(&event);
+        trace_poll();
+        stats_publish(vs);
+        //SIGUSR1 and the stats timer push FF_WAKEUP_EVENT, so both are handled while paused too
+        if (!SDL_WaitEvent(&event)) {
+            continue;
+        }
         if (FF_REFRESH_EVENT == event.type) {
+                trace_begin("refresh");
                 video_refresh_timer(event.user.data1);
+                trace_end("refresh");
         } else if (FF_QUIT_EVENT == event.type) {
                 vs->quit = 1;
                 break;
@@ -121,6 +343,14 @@ int main (int argc, char *argv[]) {
                 vs->quit = 1;
                 break;
             }
+        } else if (SDL_MOUSEBUTTONDOWN == event.type) {
+            SDL_Point point;
+            point.x = event.button.x;
+            point.y = event.button.y;
+            if (show_waveform && vs->waveform && vs->audio_stm && SDL_PointInRect(&point, &waveform_rect)) {
+                pos = waveform_time_at(vs->waveform, &waveform_rect, point.x);
+                stream_seek(vs, (int64_t)(pos * AV_TIME_BASE), pos < get_audio_clock(vs) ? -1 : 1);
+            }
         } else if (SDL_KEYDOWN == event.type) {
             switch(event.key.keysym.sym) {
                 case SDLK_LEFT:
@@ -137,12 +367,40 @@ int main (int argc, char *argv[]) {
                     goto do_seek;
                 do_seek:
                     if (global_video_state) {
-                        pos = get_audio_clock(global_video_state);
+                        pos = global_video_state->audio_stm ? get_audio_clock(global_video_state)
+                                                            : global_video_state->frame_last_pts;
                         pos += incr;
                         stream_seek(global_video_state,
                                         (int64_t)(pos * AV_TIME_BASE), incr);
                     }
                     break;
+                case SDLK_a:
+                    if (global_video_state) {
+                        stream_cycle_audio(global_video_state);
+                    }
+                    break;
+                case SDLK_m:
+                    mem_budget_report(stderr);
+                    break;
+                case SDLK_w:
+                    show_waveform = !show_waveform;
+                    break;
+                case SDLK_SPACE:
+                case SDLK_p:
+                    toggle_pause(vs);
+                    break;
+                case SDLK_s:
+                    step_to_next_frame(vs);
+                    break;
+                case SDLK_r:
+                    if (global_video_state) {
+                        if (global_video_state->reverse) {
+                            reverse_stop(global_video_state);
+                        } else {
+                            reverse_start(global_video_state);
+                        }
+                    }
+                    break;
                 default:
                     break;
                 }
@@ -151,11 +409,26 @@ int main (int argc, char *argv[]) {
     }
 
     exit:
+        reverse_stop(vs);
+        SDL_LockMutex(vs->pause_mutex);
+        SDL_CondBroadcast(vs->pause_cond);
+        SDL_UnlockMutex(vs->pause_mutex);
         SDL_CondBroadcast(vs->pictq_cond);
         SDL_CondBroadcast(vs->audioq.cond);
         SDL_CondBroadcast(vs->videoq.cond);
         SDL_CondBroadcast(sdlWindow_alloc_cond);
         SDL_WaitThread(vs->parse_tid, NULL);
+        //the decoders are closed, nothing takes packets any more
+        packet_queue_destroy(&vs->audioq);
+        packet_queue_destroy(&vs->videoq);
+        framehash_close();
+        trace_uninit();
+        stats_close();
+        thread_sched_report(stderr);
+
+    if (mem_budget_cap() > 0) {
+        mem_budget_report(stderr);
+    }
     
     if (texture) {
         SDL_DestroyTexture(texture);
@@ -171,13 +444,29 @@ int decode_thread(void *userdata) {
     VideoState *vs = (VideoState *)userdata;
     global_video_state = vs;
     int ret = 0;
+    thread_sched_enter(THREAD_DEMUX);
+    trace_thread_name("demux");
+    AVDictionary *format_opts = NULL;
     //deprecated since ffmpeg 4.0.
 	//av_register_all(); //Do Nothing. You can just omit this function call in ffmpeg 4.0 and later.
 
-    if (avformat_open_input(&(vs->formatCtx), vs->filename, NULL, NULL) < 0) {
+    vs->bench_start = vs->bench_last = av_gettime_relative();
+    vs->live_report_time = vs->bench_start;
+
+    if (live_mode) {
+        //no demuxer side buffering and only probe what is needed to open the decoders,
+        //a few KB still hold the first headers of an mpegts or flv stream
+        av_dict_set(&format_opts, "fflags", "nobuffer", 0);
+        av_dict_set(&format_opts, "probesize", "32768", 0);
+        av_dict_set(&format_opts, "analyzeduration", "0", 0);
+        av_dict_set(&format_opts, "fpsprobesize", "0", 0);
+    }
+    if (avformat_open_input(&(vs->formatCtx), vs->filename, NULL, &format_opts) < 0) {
+        av_dict_free(&format_opts);
         ret = -1;
         goto fail;
     }
+    av_dict_free(&format_opts);
     vs->formatCtx->interrupt_callback.callback = decode_interrupt_cb;
     vs->formatCtx->interrupt_callback.opaque = vs;
 
@@ -187,35 +476,58 @@ int decode_thread(void *userdata) {
     }
     av_dump_format(vs->formatCtx, 0, vs->filename, 0);
     
-    if (open_codec_context(vs, &(vs->videoStreamIndex), &(vs->videoCodecCtx), AVMEDIA_TYPE_VIDEO) < 0) {
-        ret = -1;
-        goto fail;
+    //either one alone is enough, the missing side gets no thread, queue or device
+    if (open_codec_context(vs->formatCtx, &(vs->videoStreamIndex), &(vs->videoCodecCtx), AVMEDIA_TYPE_VIDEO) < 0) {
+        avcodec_free_context(&vs->videoCodecCtx);
+        vs->videoStreamIndex = -1;
+        discard_stream_type(vs->formatCtx, AVMEDIA_TYPE_VIDEO);
+    }
+    if (open_codec_context(vs->formatCtx, &(vs->audioStreamIndex), &(vs->audioCodecCtx), AVMEDIA_TYPE_AUDIO) < 0) {
+        avcodec_free_context(&vs->audioCodecCtx);
+        vs->audioStreamIndex = -1;
+        discard_stream_type(vs->formatCtx, AVMEDIA_TYPE_AUDIO);
     }
-    if (open_codec_context(vs, &(vs->audioStreamIndex), &(vs->audioCodecCtx), AVMEDIA_TYPE_AUDIO) < 0) {
+    if (vs->videoStreamIndex < 0 && vs->audioStreamIndex < 0) {
+        fprintf(stderr, "%s: nothing to play\n", vs->filename);
         ret = -1;
         goto fail;
     }
-    if (stream_component_open(vs, AVMEDIA_TYPE_VIDEO) < 0) {
+    if (vs->videoStreamIndex >= 0 && stream_component_open(vs, AVMEDIA_TYPE_VIDEO) < 0) {
         ret = -1;
         goto fail;
     }
-    if (stream_component_open(vs, AVMEDIA_TYPE_AUDIO) < 0) {
+    if (waveform_enabled && !live_mode && vs->videoStreamIndex >= 0 && vs->audioStreamIndex >= 0) {
+        //before the audio device starts, so the callback sees it from its first block
+        vs->waveform = waveform_open(vs->filename, vs->formatCtx, vs->audioStreamIndex);
+    }
+    if (vs->audioStreamIndex >= 0 && stream_component_open(vs, AVMEDIA_TYPE_AUDIO) < 0) {
         ret = -1;
         goto fail;
     }
-    
-    SDL_Event alloc_event;
-    alloc_event.type = FF_ALLOC_EVENT;
-    alloc_event.user.data1 = vs;
-    SDL_PushEvent(&alloc_event);
-    SDL_LockMutex(sdlWindow_alloc_mutex);
-    SDL_CondWait(sdlWindow_alloc_cond, sdlWindow_alloc_mutex);
-    SDL_UnlockMutex(sdlWindow_alloc_mutex);
+    if (NULL == vs->video_stm) {
+        fprintf(stderr, "audio only, no window\n");
+    } else if (NULL == vs->audio_stm) {
+        fprintf(stderr, "video only, playing on the frame timer\n");
+    }
+
+    if (vs->video_stm) {
+        //the window belongs to the main thread, the refresh timer starts with it
+        SDL_Event alloc_event;
+        alloc_event.type = FF_ALLOC_EVENT;
+        alloc_event.user.data1 = vs;
+        SDL_PushEvent(&alloc_event);
+        SDL_LockMutex(sdlWindow_alloc_mutex);
+        SDL_CondWait(sdlWindow_alloc_cond, sdlWindow_alloc_mutex);
+        SDL_UnlockMutex(sdlWindow_alloc_mutex);
+    }
 
     AVPacket packet;
     av_init_packet(&packet);
     packet.data = NULL;
     packet.size = 0;
+    int reverse_flushed = 0;
+    int drained_checks = 0;
+    int eof_queued = 0;
 
     for(;;) {
         if (vs->quit) {
@@ -224,6 +536,7 @@ int decode_thread(void *userdata) {
 
         if (vs->seek_req) {
             int stream_index = -1;
+            trace_begin("seek");
             int64_t seek_target = vs->seek_pos;
 
             if (vs->videoStreamIndex >= 0) {
@@ -250,39 +563,130 @@ int decode_thread(void *userdata) {
                 }
             }
             vs->seek_req = 0;
+            eof_queued = 0;
+            trace_end("seek");
+        }
+
+        if (vs->audio_switch_req) {
+            stream_switch_audio(vs);
+            vs->audio_switch_req = 0;
         }
 
-        if (vs->audioq.size > MAX_AUDIOQ_SIZE ||
-                vs->videoq.size > MAX_VIDEOQ_SIZE) {
-            SDL_Delay(10);
+        if (demux_should_park(vs)) {
+            trace_begin("demux_park");
+            SDL_LockMutex(vs->pause_mutex);
+            while (demux_should_park(vs)) {
+                SDL_CondWait(vs->pause_cond, vs->pause_mutex);
+            }
+            SDL_UnlockMutex(vs->pause_mutex);
+            trace_end("demux_park");
+            continue;
+        }
+
+        if (vs->reverse) {
+            //the reverse threads demux on their own, drop what the forward decoders still hold
+            if (!reverse_flushed) {
+                if (vs->audio_stm) {
+                    packet_queue_flush(&vs->audioq);
+                    packet_queue_put(&vs->audioq, &flush_pkt);
+                }
+                packet_queue_flush(&vs->videoq);
+                packet_queue_put(&vs->videoq, &flush_pkt);
+                reverse_flushed = 1;
+            }
+            //parked until reverse_stop, which wakes us with the seek back to forward playback
+            trace_begin("demux_park");
+            SDL_LockMutex(vs->pause_mutex);
+            while (vs->reverse && !vs->quit && !vs->seek_req) {
+                SDL_CondWait(vs->pause_cond, vs->pause_mutex);
+            }
+            SDL_UnlockMutex(vs->pause_mutex);
+            trace_end("demux_park");
+            continue;
+        }
+        reverse_flushed = 0;
+
+        if (!vs->paused && packet_queues_full(vs)) {
+            SDL_Delay(live_mode ? 1 : 10);
             continue;
         }
         
 
-        if (av_read_frame(vs->formatCtx, &packet) < 0) {
+        trace_begin("demux_read");
+        ret = av_read_frame(vs->formatCtx, &packet);
+        trace_end("demux_read");
+        if (ret < 0) {
+            ret = 0;
             if (vs->formatCtx->pb->error == 0) {
-                SDL_Delay(100);
+                if (framehash_enabled() && !eof_queued) {
+                    //headless run, the decoders give out the frames they still hold
+                    vs->video_drained = vs->audio_drained = 0;
+                    if (vs->video_stm) {
+                        packet_queue_put_nullpacket(&vs->videoq);
+                    }
+                    if (vs->audio_stm) {
+                        packet_queue_put_nullpacket(&vs->audioq);
+                    }
+                    eof_queued = 1;
+                }
+                SDL_Delay(live_mode ? 5 : 100);
+                if (framehash_enabled() &&
+                        (NULL == vs->video_stm || vs->video_drained) &&
+                        (NULL == vs->audio_stm || vs->audio_drained) &&
+                        vs->pictq_size == 0 && ++drained_checks > 1) {
+                    //decoders drained and every picture shown, two checks in a row for the last audio block
+                    SDL_Event event;
+                    event.type = FF_QUIT_EVENT;
+                    event.user.data1 = vs;
+                    SDL_PushEvent(&event);
+                    break;
+                }
                 continue;
             } else {
                 break;
             }
             
         }
+        drained_checks = 0;
+        eof_queued = 0;
+
+        if (bench_mode) {
+            bench_account(vs, &packet, packet.stream_index == vs->videoStreamIndex ||
+                                       packet.stream_index == vs->audioStreamIndex);
+        }
+
+        if (live_mode) {
+            AVStream *clock_stm = vs->audio_stm ? vs->audio_stm : vs->video_stm;
+            if (clock_stm && packet.stream_index == clock_stm->index && packet.pts != AV_NOPTS_VALUE) {
+                vs->live_last_pts = packet.pts * av_q2d(clock_stm->time_base);
+                vs->live_last_time = av_gettime_relative();
+            }
+            live_report(vs, 0);
+        }
 
         if (packet.stream_index == vs->videoStreamIndex) {
             packet_queue_put(&vs->videoq, &packet);
         } else if (packet.stream_index == vs->audioStreamIndex) {
             packet_queue_put(&vs->audioq, &packet);
-        } else {
-            av_packet_unref(&packet);
         }
+        //blank when a queue took it, otherwise a packet of a stream nobody decodes
+        av_packet_unref(&packet);
+        trace_counter("videoq packets", vs->videoq.nb_packets);
+        trace_counter("audioq packets", vs->audioq.nb_packets);
+    }
 
-       
+    if (bench_mode) {
+        bench_report(vs, 1);
+    }
+    if (live_mode) {
+        live_report(vs, 1);
     }
 
+    SDL_LockMutex(vs->pause_mutex);
     while(!vs->quit) {
-        SDL_Delay(100);
+        SDL_CondWait(vs->pause_cond, vs->pause_mutex);
     }
+    SDL_UnlockMutex(vs->pause_mutex);
 
     ret = 0;
 
@@ -308,22 +712,70 @@ int decode_thread(void *userdata) {
         return ret;
 }
 
-int open_codec_context(VideoState *vs, int *stream_idx, AVCodecContext **dec_ctx, enum AVMediaType type)
+static int packet_queues_full(VideoState *vs) {
+    if (vs->audioq.size > max_audioq_size || vs->videoq.size > max_videoq_size) {
+        return 1;
+    }
+    //the queues are what can give memory back, shrink them while over the budget
+    if (mem_budget_exceeded()) {
+        return (!vs->audio_stm || vs->audioq.nb_packets > BUDGET_MIN_QUEUE_PACKETS) &&
+               (!vs->video_stm || vs->videoq.nb_packets > BUDGET_MIN_QUEUE_PACKETS);
+    }
+    return 0;
+}
+
+/* While paused the demuxer only wakes to seek, or to feed the video decoder when frame
+ * stepping has drained the picture queue. A frame threaded decoder holds a packet per
+ * thread, plus the reordering delay, before the first picture comes out. */
+static int demux_should_park(VideoState *vs) {
+    int wanted;
+
+    if (!vs->paused || vs->quit || vs->seek_req || vs->audio_switch_req) {
+        return 0;
+    }
+    if (NULL == vs->video_stm || vs->pictq_size > 0) {
+        return 1;
+    }
+    wanted = FFMAX(1, vs->videoCodecCtx->thread_count) + vs->videoCodecCtx->has_b_frames + 1;
+    return vs->videoq.nb_packets >= wanted;
+}
+
+//no decoder for this type, the demuxer can skip all of its streams
+static void discard_stream_type(AVFormatContext *fmt_ctx, enum AVMediaType type) {
+    unsigned int i;
+
+    if (!discard_unused) {
+        return;
+    }
+    for (i = 0; i < fmt_ctx->nb_streams; i++) {
+        if (fmt_ctx->streams[i]->codecpar->codec_type == type) {
+            fmt_ctx->streams[i]->discard = AVDISCARD_ALL;
+        }
+    }
+}
+
+int open_codec_context(AVFormatContext *fmt_ctx, int *stream_idx, AVCodecContext **dec_ctx, enum AVMediaType type)
 {
-    AVFormatContext *fmt_ctx = vs->formatCtx;
     int ret, stream_index;
     AVStream *st;
     AVCodec *dec = NULL;
     AVDictionary *opts = NULL;
+    ThreadSnapshot threads_before;
 
-    ret = av_find_best_stream(fmt_ctx, type, -1, -1, NULL, 0);
+    //*stream_idx is the wanted stream, -1 lets ffmpeg pick the best one
+    ret = av_find_best_stream(fmt_ctx, type, *stream_idx, -1, NULL, 0);
     if (ret < 0) {
         fprintf(stderr, "Could not find %s stream in input file '%s'\n",
-                av_get_media_type_string(type), vs->filename);
+                av_get_media_type_string(type), fmt_ctx->url);
         return ret;
     } else {
         stream_index = ret;
         st = fmt_ctx->streams[stream_index];
+        if (type == AVMEDIA_TYPE_VIDEO && (st->disposition & AV_DISPOSITION_ATTACHED_PIC)) {
+            //cover art of an audio file, a single picture and no video to play
+            fprintf(stderr, "Only cover art, no video stream in input file '%s'\n", fmt_ctx->url);
+            return AVERROR_STREAM_NOT_FOUND;
+        }
 
         /* find decoder for the stream */
         dec = avcodec_find_decoder(st->codecpar->codec_id);
@@ -348,83 +800,213 @@ int open_codec_context(VideoState *vs, int *stream_idx, AVCodecContext **dec_ctx
             return ret;
         }
 
+        if (live_mode) {
+            //frame threading holds back one frame per thread, slices do not add delay
+            (*dec_ctx)->flags |= AV_CODEC_FLAG_LOW_DELAY;
+            (*dec_ctx)->flags2 |= AV_CODEC_FLAG2_FAST;
+            (*dec_ctx)->thread_type = FF_THREAD_SLICE;
+        }
+
         /* Init the decoders, with or without reference counting */
         //av_dict_set(&opts, "refcounted_frames", refcount ? "1" : "0", 0);
-        if ((ret = avcodec_open2(*dec_ctx, dec, &opts)) < 0) {
+        av_dict_set(&opts, "threads", decoder_threads, 0);
+        //the decoder threads are started by avcodec_open2
+        thread_sched_snapshot(&threads_before);
+        ret = avcodec_open2(*dec_ctx, dec, &opts);
+        //the adopt also ends the snapshot, a failed open has no threads left to adopt
+        thread_sched_adopt(THREAD_DECODER, &threads_before, type == AVMEDIA_TYPE_VIDEO ? "vdec" : "adec");
+        av_dict_free(&opts);
+        if (ret < 0) {
             fprintf(stderr, "Failed to open %s codec\n",
                     av_get_media_type_string(type));
             return ret;
         }
         *stream_idx = stream_index;
+
+        /* let the demuxer skip every stream nobody is going to decode: the other streams
+         * of this type, and the types the player never decodes */
+        if (discard_unused) {
+            unsigned int i;
+            for (i = 0; i < fmt_ctx->nb_streams; i++) {
+                enum AVMediaType stream_type = fmt_ctx->streams[i]->codecpar->codec_type;
+                if (i == stream_index) {
+                    fmt_ctx->streams[i]->discard = AVDISCARD_DEFAULT;
+                } else if (stream_type == type ||
+                        (stream_type != AVMEDIA_TYPE_AUDIO && stream_type != AVMEDIA_TYPE_VIDEO)) {
+                    fmt_ctx->streams[i]->discard = AVDISCARD_ALL;
+                }
+            }
+        }
     }
 
     return 0;
 }
 
-int queue_picture(VideoState *vs, AVFrame *pFrame, double pts) {
+/* Called from the demux thread. The new decoder is opened here, but handed over to the
+ * audio callback through the flush packet, so the callback never sees a half switched state. */
+static void stream_switch_audio(VideoState *vs) {
+    AVFormatContext *formatCtx = vs->formatCtx;
+    AVCodecContext *codecCtx = NULL;
+    int start = vs->audioStreamIndex;
+    int stream_index = -1;
+    unsigned int i;
+
+    if (start < 0 || vs->audio_pending_ctx) {
+        return;
+    }
+    for (i = 1; i < formatCtx->nb_streams; i++) {
+        int index = (start + i) % formatCtx->nb_streams;
+        if (formatCtx->streams[index]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO) {
+            stream_index = index;
+            break;
+        }
+    }
+    if (stream_index < 0) {
+        fprintf(stderr, "No other audio stream to switch to\n");
+        return;
+    }
+    if (open_codec_context(formatCtx, &stream_index, &codecCtx, AVMEDIA_TYPE_AUDIO) < 0) {
+        avcodec_free_context(&codecCtx);
+        return;
+    }
+    fprintf(stdout, "switch audio stream %d -> %d\n", start, stream_index);
+
+    vs->audio_pending_ctx = codecCtx;
+    vs->audio_pending_index = stream_index;
+    vs->audioStreamIndex = stream_index;
+    packet_queue_flush(&vs->audioq);
+    packet_queue_put(&vs->audioq, &flush_pkt);
+}
+
+static int queue_picture_locked(VideoState *vs, AVFrame *pFrame, double pts, int reverse);
+
+int queue_picture(VideoState *vs, AVFrame *pFrame, double pts, int reverse) {
+    int ret;
+
+    SDL_LockMutex(vs->pictq_write_mutex);
+    ret = queue_picture_locked(vs, pFrame, pts, reverse);
+    SDL_UnlockMutex(vs->pictq_write_mutex);
+    return ret;
+}
+
+/* Over the memory budget the slots nobody reads give their buffers back, and the pool
+ * drops the ones it kept once, so the pictures held come down to the ones queued. */
+static void pictq_release_idle(VideoState *vs) {
+    int i, idle;
+
+    SDL_LockMutex(vs->pictq_mutex);
+    idle = vs->pictq_depth - vs->pictq_size;
+    SDL_UnlockMutex(vs->pictq_mutex);
+    //the slot at the write index is filled next and keeps its buffer
+    for (i = 1; i < idle; i++) {
+        VideoPicture *vp = &vs->pict_q[(vs->pictq_windex + i) % vs->pictq_depth];
+        if (vp->pictYUV) {
+            av_frame_unref(vp->pictYUV);
+        }
+    }
+    if (!vs->pictq_trimmed) {
+        frame_pool_uninit(&vs->picture_pool);
+        vs->pictq_trimmed = 1;
+    }
+}
+
+static int queue_picture_locked(VideoState *vs, AVFrame *pFrame, double pts, int reverse) {
     VideoPicture *vp;
-    int dst_pix_fmt;
-    AVPicture pict;
+    struct SwsContext *sws_ctx;
+    int64_t switch_start = 0;
+    int over_budget = mem_budget_exceeded();
+    int depth = over_budget ? FFMIN(vs->pictq_depth, BUDGET_MAX_PICTURES) : vs->pictq_depth;
 
+    trace_begin("pictq_wait");
     SDL_LockMutex(vs->pictq_mutex);
-    while(vs->pictq_size >= VIDEO_PICTURE_QUEUE_SIZE && !vs->quit) {
+    while(vs->pictq_size >= depth && !vs->quit && vs->reverse == reverse) {
         SDL_CondWait(vs->pictq_cond, vs->pictq_mutex);
     }
 
     SDL_UnlockMutex(vs->pictq_mutex);
+    trace_end("pictq_wait");
 
     if (vs->quit) {
         return -1;
     }
+    if (vs->reverse != reverse) {
+        //the other direction owns the display now, drop this picture
+        return 0;
+    }
+    if (over_budget) {
+        pictq_release_idle(vs);
+    } else {
+        vs->pictq_trimmed = 0;
+    }
+
+    //adaptive streams may change size or format at any frame
+    if (pFrame->width != vs->src_width || pFrame->height != vs->src_height ||
+            pFrame->format != vs->src_format) {
+        switch_start = av_gettime_relative();
+    }
+    sws_ctx = scaler_cache_get(&vs->scalers,
+                               pFrame->width, pFrame->height, pFrame->format,
+                               pFrame->width, pFrame->height, AV_PIX_FMT_YUV420P);
+    if (NULL == sws_ctx) {
+        fprintf(stderr, "No converter for %dx%d %s\n", pFrame->width, pFrame->height,
+                av_get_pix_fmt_name(pFrame->format));
+        return -1;
+    }
 
     vp = &vs->pict_q[vs->pictq_windex];
-    if (NULL == vp->pictYUV ||
-        vp->width != vs->video_stm->codecpar->width ||
-        vp->height != vs->video_stm->codecpar->height) {
-        if (NULL != vp->pictYUV) {
-            av_frame_free(&(vp->pictYUV));
-            vp->pictYUV = NULL;
-        }
-        vp->pictYUV = av_frame_alloc(); // or av_frame_alloc()
+    if (NULL == vp->pictYUV) {
+        vp->pictYUV = av_frame_alloc();
         if (NULL == vp->pictYUV) {
             return -1;
         }
-        AVCodecParameters *videoCodecPar = vs->video_stm->codecpar;
-        vp->pictYUV->width = videoCodecPar->width;
-        vp->pictYUV->height = videoCodecPar->height;
-        vp->pictYUV->format = AV_PIX_FMT_YUV420P;
-        /*The following fields must be set on frame before calling this function:
-                format (pixel format for video, sample format for audio)
-                width and height for video
-                nb_samples and channel_layout for audio
-        */
-        if (av_frame_get_buffer(vp->pictYUV, 0) < 0) { //Allocate new buffer for frame failed
-            av_frame_free(&(vp->pictYUV));
-            vp->pictYUV = NULL;
-        } 
     }
-    if (vp->pictYUV) {
-        sws_scale(
-                    vs->sws_ctx,
-                    (uint8_t const * const *)pFrame->data,
-                    pFrame->linesize,
-                    0,
-                    vs->video_stm->codecpar->height,
-                    vp->pictYUV->data,
-                    vp->pictYUV->linesize
-                );
-        vp->pts = pts;
-        //av_frame_copy ? copy meta data?
-    }
-    vp->width = vs->video_stm->codecpar->width;
-    vp->height = vs->video_stm->codecpar->height;
-    if (++vs->pictq_windex == VIDEO_PICTURE_QUEUE_SIZE) {
+    if (NULL == vp->pictYUV->buf[0] ||
+        vp->width != pFrame->width ||
+        vp->height != pFrame->height) {
+        //give the old buffer back to its pool, take one of the new size
+        av_frame_unref(vp->pictYUV);
+        if (frame_pool_get(&vs->picture_pool, vp->pictYUV,
+                           pFrame->width, pFrame->height, AV_PIX_FMT_YUV420P) < 0) {
+            //the slot stays empty and is not queued, the picture is dropped
+            fprintf(stderr, "Failed to get a %dx%d picture buffer, picture dropped\n", pFrame->width, pFrame->height);
+            return 0;
+        }
+    }
+    trace_begin("convert");
+    sws_scale(
+                sws_ctx,
+                (uint8_t const * const *)pFrame->data,
+                pFrame->linesize,
+                0,
+                pFrame->height,
+                vp->pictYUV->data,
+                vp->pictYUV->linesize
+            );
+    trace_end("convert");
+    vp->pts = pts;
+    vp->reverse = reverse;
+    //av_frame_copy ? copy meta data?
+    vp->width = pFrame->width;
+    vp->height = pFrame->height;
+    if (switch_start) {
+        //converter lookup, picture reallocation and the first conversion
+        fprintf(stderr, "video format %dx%d %s -> %dx%d %s took %.2f ms (scaler cache %d hits, %d misses)\n",
+                vs->src_width, vs->src_height, av_get_pix_fmt_name(vs->src_format),
+                pFrame->width, pFrame->height, av_get_pix_fmt_name(pFrame->format),
+                (av_gettime_relative() - switch_start) / 1000.0,
+                vs->scalers.hits, vs->scalers.misses);
+        vs->src_width = pFrame->width;
+        vs->src_height = pFrame->height;
+        vs->src_format = pFrame->format;
+    }
+    if (++vs->pictq_windex == vs->pictq_depth) {
         vs->pictq_windex = 0;
     }
 
     SDL_LockMutex(vs->pictq_mutex);
     vs->pictq_size++;
     SDL_UnlockMutex(vs->pictq_mutex);
+    trace_counter("pictq", vs->pictq_size);
     return 0;
 
 }
@@ -437,11 +1019,26 @@ int video_thread(void *userdata) {
     
     double pts = 0;
     AVFrame *frame;
+    thread_sched_enter(THREAD_VIDEO);
+    trace_thread_name("video");
     frame = av_frame_alloc();
     for (;;) {
-        if (packet_queue_get(&vs->videoq, packet, 1, &vs->quit) < 0) {
+        trace_begin("videoq_get");
+        int got = packet_queue_get(&vs->videoq, packet, 1, &vs->quit);
+        trace_end("videoq_get");
+        if (got < 0) {
             //means we need to quit getting packets
             break;
+        } else if (got == 0) {
+            //woken up without a packet
+            continue;
+        }
+
+        if (vs->paused) {
+            //a parked demuxer refills the queue for the next step
+            SDL_LockMutex(vs->pause_mutex);
+            SDL_CondBroadcast(vs->pause_cond);
+            SDL_UnlockMutex(vs->pause_mutex);
         }
 
         if (packet->data == flush_pkt.data) {
@@ -450,24 +1047,33 @@ int video_thread(void *userdata) {
         }
         pts = 0;
 
-        int ret = avcodec_send_packet(videoCodecCtx, packet);
+        trace_begin("decode_send");
+        //the empty packet queued at the end of file drains the decoder
+        int ret = avcodec_send_packet(videoCodecCtx, packet->data ? packet : NULL);
+        trace_end("decode_send");
         if (ret < 0) {
             fprintf(stderr, "Error sending a packet for decoding\n");
             continue;
         }
 
         while (ret >= 0) {
+            trace_begin("decode_receive");
             ret = avcodec_receive_frame(videoCodecCtx, frame);
+            trace_end("decode_receive");
             if (ret == 0) {
+                vs->frames_decoded++;
                 if ((pts = frame->best_effort_timestamp) == AV_NOPTS_VALUE) {
                     pts = 0;
                 }
                 pts *= av_q2d(vs->video_stm->time_base);
                 pts = synchronize_video(vs, frame, pts);
-                if (queue_picture(vs, frame, pts) < 0) {
+                if (queue_picture(vs, frame, pts, 0) < 0) {
                     goto fail;
                 }
-            } else if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+            } else if (ret == AVERROR_EOF) {
+                vs->video_drained = 1;
+                break;
+            } else if (ret == AVERROR(EAGAIN)) {
                 break;
             } else if (ret < 0) {
                 fprintf(stderr, "Error during decoding\n");
@@ -505,18 +1111,22 @@ void stream_component_close(VideoState *vs, enum AVMediaType type) {
             swr_close(vs->swr_ctx);
             vs->audio_buf_size = 0;
             vs->audio_buf_index = 0;
-            if (NULL != out_buffer) {
-                free(out_buffer);
+            if (NULL != vs->audio_buf) {
+                av_freep(&(vs->audio_buf));
+                mem_budget_sub(MEM_AUDIO, vs->audio_buf_alloc);
+                vs->audio_buf_alloc = 0;
             }
             
             SDL_CloseAudio();
+            waveform_close(&vs->waveform);
             break;
         case AVMEDIA_TYPE_VIDEO:
             vs->videoStreamIndex = -1;
             vs->video_stm = NULL;
             avcodec_free_context(&(vs->videoCodecCtx));
-            //sws_close(vs->sws_ctx);
             SDL_WaitThread(vs->video_tid, NULL);
+            scaler_cache_free(&vs->scalers);
+            frame_pool_uninit(&vs->picture_pool);
             break;
         default:
             break;
@@ -533,14 +1143,18 @@ int stream_component_open(VideoState *vs, enum AVMediaType type) {
             codecCtx = vs->audioCodecCtx;
             vs->audio_buf_size = 0;
             vs->audio_buf_index = 0;
-            if (audio_out_linesize == -1) {
-                int out_buffer_size = av_samples_get_buffer_size(&audio_out_linesize, codecCtx->channels,codecCtx->frame_size,codecCtx->sample_fmt, 1);
-                out_buffer = malloc(out_buffer_size);
-                fprintf(stdout, "get samples buffer size:%d outlinesize:%d\n", out_buffer_size, audio_out_linesize);
+            if (NULL == vs->audio_buf) {
+                vs->audio_buf = av_malloc(AUDIO_BUF_SIZE);
+                if (NULL == vs->audio_buf) {
+                    return -1;
+                }
+                vs->audio_buf_alloc = AUDIO_BUF_SIZE;
+                mem_budget_add(MEM_AUDIO, vs->audio_buf_alloc);
+            }
+            if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
+                fprintf(stderr, "SDL audio init error:%s\n", SDL_GetError());
+                return -1;
             }
-            vs->swr_ctx = swr_alloc();
-            vs->swr_ctx = swr_alloc_set_opts(vs->swr_ctx, AV_CH_LAYOUT_STEREO, AV_SAMPLE_FMT_S16, codecCtx->sample_rate, codecCtx->channel_layout, codecCtx->sample_fmt, codecCtx->sample_rate, 0, NULL);
-            swr_init(vs->swr_ctx);
             SDL_AudioSpec wanted_spec, haved_spec;
             SDL_zero(wanted_spec);
             SDL_zero(haved_spec);
@@ -549,7 +1163,7 @@ int stream_component_open(VideoState *vs, enum AVMediaType type) {
             wanted_spec.format = AUDIO_S16SYS;
             wanted_spec.channels = codecCtx->channels;
             wanted_spec.silence = 0;
-            wanted_spec.samples = SDL_AUDIO_BUFFER_SIZE;
+            wanted_spec.samples = audio_buffer_samples;
             wanted_spec.callback = audio_callback;
             wanted_spec.userdata = vs;
 
@@ -561,6 +1175,11 @@ int stream_component_open(VideoState *vs, enum AVMediaType type) {
                     fprintf(stderr, "Can't get Signed16 SYS audio format.\n");
                 }
             }
+            //the resampler targets what the device really gave us, so any later track fits it too
+            audio_channels = haved_spec.channels;
+            audio_hw_freq = haved_spec.freq;
+            audio_hw_buf_size = haved_spec.size;
+            vs->swr_ctx = audio_open_resampler(codecCtx);
 
             packet_queue_init(&vs->audioq);
 
@@ -574,19 +1193,14 @@ int stream_component_open(VideoState *vs, enum AVMediaType type) {
             vs->frame_last_delay = 40e-3;
 
             vs->video_stm = formatCtx->streams[vs->videoStreamIndex];
-            
-            vs->sws_ctx = sws_getContext(
-                codecCtx->width,
-                codecCtx->height,
-                codecCtx->pix_fmt,
-                codecCtx->width,
-                codecCtx->height,
-                AV_PIX_FMT_YUV420P,
-                SWS_BILINEAR,
-                NULL,
-                NULL,
-                NULL
-            );
+
+            //the converter for the format the stream starts with, frames may change it later
+            vs->src_width = codecCtx->width;
+            vs->src_height = codecCtx->height;
+            vs->src_format = codecCtx->pix_fmt;
+            scaler_cache_get(&vs->scalers,
+                             codecCtx->width, codecCtx->height, codecCtx->pix_fmt,
+                             codecCtx->width, codecCtx->height, AV_PIX_FMT_YUV420P);
             packet_queue_init(&vs->videoq);
             vs->video_tid = SDL_CreateThread(video_thread, "video_thread", vs);
             break;
@@ -596,22 +1210,79 @@ int stream_component_open(VideoState *vs, enum AVMediaType type) {
     return 0;
 }
 
+static struct SwrContext *audio_open_resampler(AVCodecContext *codecCtx) {
+    struct SwrContext *swr_ctx;
+    int64_t in_layout = codecCtx->channel_layout;
+
+    if (0 == in_layout) {
+        in_layout = av_get_default_channel_layout(codecCtx->channels);
+    }
+    swr_ctx = swr_alloc_set_opts(NULL,
+                av_get_default_channel_layout(audio_channels), AV_SAMPLE_FMT_S16, audio_hw_freq,
+                in_layout, codecCtx->sample_fmt, codecCtx->sample_rate,
+                0, NULL);
+    if (NULL == swr_ctx || swr_init(swr_ctx) < 0) {
+        fprintf(stderr, "Failed to init the audio resampler\n");
+        swr_free(&swr_ctx);
+    }
+    return swr_ctx;
+}
+
+/* Runs on the audio thread when it meets the flush packet of a track switch. */
+static void audio_apply_switch(VideoState *vs) {
+    AVCodecContext *codecCtx = vs->audio_pending_ctx;
+
+    avcodec_free_context(&(vs->audioCodecCtx));
+    vs->audioCodecCtx = codecCtx;
+    vs->audio_stm = vs->formatCtx->streams[vs->audio_pending_index];
+    swr_free(&(vs->swr_ctx));
+    vs->swr_ctx = audio_open_resampler(codecCtx);
+    vs->audio_pending_ctx = NULL;
+}
+
 
 void audio_callback(void *userdata, Uint8 *stream, int len) {
     VideoState *vs = (VideoState *)userdata;
     int len1, audio_decoded_size;
     double pkt_pts;
 
+    thread_sched_enter(THREAD_AUDIO);
+    trace_thread_name("audio");
     SDL_memset(stream, 0, len);
+    if (vs->reverse || vs->paused) {
+        //no reverse audio, play silence. Paused only until SDL_PauseAudio took effect
+        return;
+    }
+    trace_begin("audio_callback");
 
     while (len > 0) {
         if (vs->audio_buf_index >= vs->audio_buf_size) {
-            audio_decoded_size = audio_decode_frame(vs, vs->audio_buf, sizeof(vs->audio_buf), &pkt_pts);
+            trace_begin("audio_decode");
+            audio_decoded_size = audio_decode_frame(vs, vs->audio_buf, vs->audio_buf_alloc, &pkt_pts);
+            trace_end("audio_decode");
+            if (audio_decoded_size < 0 && vs->paused) {
+                //woken by the pause, no silence is left in audio_buf to play after resuming
+                break;
+            }
             if (audio_decoded_size < 0) {
+                if (!vs->quit) {
+                    vs->audio_underruns++;
+                    trace_instant("audio_underrun");
+                }
                 vs->audio_buf_size = 1024;
                 memset(vs->audio_buf,0,vs->audio_buf_size);
             } else {
                 vs->audio_buf_size = audio_decoded_size;
+                if (framehash_enabled()) {
+                    framehash_audio(vs->audio_buf, audio_decoded_size, pkt_pts);
+                }
+                if (vs->waveform) {
+                    //audio_clock is at the end of the block
+                    int frame_size = 2 * audio_channels;
+                    waveform_feed(vs->waveform, vs->audio_stm->index, (const int16_t *)vs->audio_buf,
+                                  audio_decoded_size / frame_size, audio_channels, audio_hw_freq,
+                                  vs->audio_clock - (double)audio_decoded_size / (frame_size * audio_hw_freq));
+                }
             }
             vs->audio_buf_index = 0;
         }
@@ -626,6 +1297,7 @@ void audio_callback(void *userdata, Uint8 *stream, int len) {
         stream += len1;
         vs->audio_buf_index += len1;
     }
+    trace_end("audio_callback");
 }
 
 int audio_decode_frame(VideoState *vs, uint8_t *audio_buf, int buf_size, double *pts_ptr) {
@@ -647,14 +1319,20 @@ int audio_decode_frame(VideoState *vs, uint8_t *audio_buf, int buf_size, double
             av_packet_unref(audioPkt);
         }
 
-        if (vs->quit) {
+        if (vs->quit || vs->paused) {
             return -1;
         }
 
-        if (packet_queue_get(&vs->audioq, audioPkt, 1, &vs->quit) < 0) {
+        if (packet_queue_get(&vs->audioq, audioPkt, 1, &vs->quit) <= 0) {
+            //quit, or woken up by a pause
             return -1;
         }
+        trace_counter("audioq packets", vs->audioq.nb_packets);
         if (audioPkt->data == flush_pkt.data) {
+            if (vs->audio_pending_ctx) {
+                audio_apply_switch(vs);
+                audioCodecCtx = vs->audioCodecCtx;
+            }
             avcodec_flush_buffers(vs->audioCodecCtx);
             continue;
         }
@@ -663,7 +1341,13 @@ int audio_decode_frame(VideoState *vs, uint8_t *audio_buf, int buf_size, double
             vs->audio_clock = av_q2d(vs->audio_stm->time_base) * audioPkt->pts;
         }
 
-        int ret = avcodec_send_packet(audioCodecCtx, audioPkt);
+        if (live_mode && get_live_latency(vs) > LIVE_LATENCY_MAX) {
+            //too far behind to catch up by speed, drop until the clock is close to the source
+            vs->live_audio_dropped++;
+            continue;
+        }
+
+        int ret = avcodec_send_packet(audioCodecCtx, audioPkt->data ? audioPkt : NULL);
         if (ret < 0) {
             fprintf(stderr, "Error sending a audio packet for decoding\n");
             continue;
@@ -674,12 +1358,34 @@ int audio_decode_frame(VideoState *vs, uint8_t *audio_buf, int buf_size, double
             if (ret == 0) {
                 int out_nb_samples = audioFrame->nb_samples;
                 int out_len;
-                if (audioFrame->format != AV_SAMPLE_FMT_S16) {
-                    out_nb_samples = swr_convert(vs->swr_ctx, &out_buffer, audio_out_linesize, (const uint8_t **)audioFrame->data, audioFrame->nb_samples);
-                    out_len = av_samples_get_buffer_size(NULL, audioCodecCtx->channels, out_nb_samples, AV_SAMPLE_FMT_S16, 1);
-                    memcpy(audio_buf, out_buffer, out_len);
+                int n;
+                int wanted_nb_samples = audioFrame->nb_samples;
+                if (live_mode) {
+                    if (get_live_latency(vs) > LIVE_LATENCY_TARGET) {
+                        wanted_nb_samples = (int)(audioFrame->nb_samples * (1.0 - LIVE_SPEEDUP));
+                    }
+                    swr_set_compensation(vs->swr_ctx,
+                            (wanted_nb_samples - audioFrame->nb_samples) * audio_hw_freq / audioFrame->sample_rate,
+                            wanted_nb_samples * audio_hw_freq / audioFrame->sample_rate);
+                }
+                //room left in audio_buf, in S16 samples per channel
+                int room_nb_samples = (buf_size - data_size) / (2 * audio_channels);
+                if (audioFrame->format != AV_SAMPLE_FMT_S16 ||
+                        audioFrame->channels != audio_channels ||
+                        audioFrame->sample_rate != audio_hw_freq ||
+                        wanted_nb_samples != audioFrame->nb_samples) {
+                    //convert straight into audio_buf, what does not fit stays in the resampler
+                    out_nb_samples = swr_convert(vs->swr_ctx, &audio_buf, room_nb_samples, (const uint8_t **)audioFrame->data, audioFrame->nb_samples);
+                    if (out_nb_samples < 0) {
+                        out_nb_samples = 0;
+                    }
+                    out_len = av_samples_get_buffer_size(NULL, audio_channels, out_nb_samples, AV_SAMPLE_FMT_S16, 1);
                 } else {
-                    out_len = av_samples_get_buffer_size(NULL, audioCodecCtx->channels, out_nb_samples, AV_SAMPLE_FMT_S16, 1);
+                    if (out_nb_samples > room_nb_samples) {
+                        fprintf(stderr, "audio buffer full, dropping %d samples\n", out_nb_samples - room_nb_samples);
+                        out_nb_samples = room_nb_samples;
+                    }
+                    out_len = av_samples_get_buffer_size(NULL, audio_channels, out_nb_samples, AV_SAMPLE_FMT_S16, 1);
                     memcpy(audio_buf, audioFrame->data[0], out_len);
                 }
                 audio_buf += out_len;
@@ -689,16 +1395,22 @@ int audio_decode_frame(VideoState *vs, uint8_t *audio_buf, int buf_size, double
 
                 pts = vs->audio_clock;
                 *pts_ptr = pts;
-                n = 2 * vs->audio_stm->codecpar->channels;
-                vs->audio_clock += (double)out_len / (double)(n * vs->audio_stm->codecpar->sample_rate);
-            } else if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+                n = 2 * audio_channels;
+                vs->audio_clock += (double)out_len / (double)(n * audio_hw_freq);
+            } else if (ret == AVERROR_EOF) {
+                vs->audio_drained = 1;
+                break;
+            } else if (ret == AVERROR(EAGAIN)) {
                 break;
             } else if (ret < 0) {
                 fprintf(stderr, "Error during decoding\n");
                 break;
             }
         }
-        return data_size;
+        if (data_size > 0) {
+            return data_size;
+        }
+        //drained without a sample, wait for the next packet
 
     }
 }
@@ -714,15 +1426,34 @@ void video_display (VideoState *vs) {
 
     vp = &vs->pict_q[vs->pictq_rindex];
     if (vp->pictYUV) {
+        if (vp->width != texture_width || vp->height != texture_height) {
+            //the stream changed size, the texture follows
+            int64_t start = av_gettime_relative();
+            SDL_Texture *resized = SDL_CreateTexture(renderer,
+                SDL_PIXELFORMAT_YV12,
+                SDL_TEXTUREACCESS_STREAMING,
+                vp->width, vp->height);
+            if (NULL == resized) {
+                fprintf(stderr, "SDL_CreateTexture error:%s\n",SDL_GetError());
+                return;
+            }
+            SDL_DestroyTexture(texture);
+            texture = resized;
+            texture_width = vp->width;
+            texture_height = vp->height;
+            fprintf(stderr, "texture resized to %dx%d in %.2f ms\n", vp->width, vp->height,
+                    (av_gettime_relative() - start) / 1000.0);
+        }
+
         if (vs->video_stm->codecpar->sample_aspect_ratio.num == 0) {
             aspect_ratio = 0;
         } else {
             aspect_ratio = av_q2d(vs->video_stm->codecpar->sample_aspect_ratio) *
-                vs->video_stm->codecpar->width / vs->video_stm->codecpar->height;
+                vp->width / vp->height;
         }
 
         if (aspect_ratio <= 0.0) {
-            aspect_ratio = (float)vs->video_stm->codecpar->width / (float)vs->video_stm->codecpar->height;
+            aspect_ratio = (float)vp->width / (float)vp->height;
         }
 
         SDL_GetWindowSize(sdlWindow, &screenW, &screenH);
@@ -740,27 +1471,63 @@ void video_display (VideoState *vs) {
         rect.y = y;
         rect.w = w;
         rect.h = h;
-        SDL_UpdateYUVTexture(texture, &rect, 
+        SDL_UpdateYUVTexture(texture, NULL,
                 vp->pictYUV->data[0], vp->pictYUV->linesize[0],
                 vp->pictYUV->data[1], vp->pictYUV->linesize[1],
                 vp->pictYUV->data[2], vp->pictYUV->linesize[2]);
         SDL_RenderClear(renderer);
-        SDL_RenderCopy(renderer, texture, NULL, NULL);
+        SDL_RenderCopy(renderer, texture, NULL, &rect);
+        if (show_waveform && vs->waveform) {
+            //over the bottom sixth of the window
+            waveform_rect.x = 0;
+            waveform_rect.w = screenW;
+            waveform_rect.h = screenH / 6;
+            waveform_rect.y = screenH - waveform_rect.h;
+            waveform_draw(vs->waveform, renderer, &waveform_rect, get_audio_clock(vs));
+        }
         SDL_RenderPresent(renderer);
     }
 }
 
+//release the picture at the read index to the decoder side
+static void pictq_next(VideoState *vs) {
+    if (++vs->pictq_rindex == vs->pictq_depth) {
+        vs->pictq_rindex = 0;
+    }
+
+    SDL_LockMutex(vs->pictq_mutex);
+    vs->pictq_size--;
+    SDL_CondSignal(vs->pictq_cond);
+    SDL_UnlockMutex(vs->pictq_mutex);
+    trace_counter("pictq", vs->pictq_size);
+}
+
 void video_refresh_timer(void *userdata) {
     VideoState *vs = (VideoState *)userdata;
     VideoPicture *vp = NULL;
-    double actual_delay, delay, sync_threshold, ref_clock, diff;
+    double actual_delay, delay, ref_clock, diff;
+
+    if (vs->paused) {
+        //stop the timer, toggle_pause restarts it
+        vs->refresh_parked = 1;
+        return;
+    }
 
     if (vs->video_stm) {
         if(vs->pictq_size == 0) {
             schedule_refresh(vs, 10);
         } else {
             vp = &vs->pict_q[vs->pictq_rindex];
+            if (vp->reverse != vs->reverse) {
+                //queued before the direction changed
+                pictq_next(vs);
+                schedule_refresh(vs, 1);
+                return;
+            }
             delay = vp->pts - vs->frame_last_pts;
+            if (vs->reverse) {
+                delay = -delay;
+            }
             //use the previous pts and this pts to predict next frame's pts (usually the delay is 1/framerate--by joe)
             if (delay <= 0 || delay >= 1.0) {
                 delay = vs->frame_last_delay;
@@ -770,25 +1537,20 @@ void video_refresh_timer(void *userdata) {
             vs->frame_last_pts = vp->pts;
 
 
-            //update delay to sync to audio
-            ref_clock = get_audio_clock(vs);
+            //update delay to sync to audio, reverse and video only playback run on the frame timer alone
+            ref_clock = (vs->reverse || NULL == vs->audio_stm) ? vp->pts : get_audio_clock(vs);
             diff = vp->pts - ref_clock;
 
-            // sync_threshold = (delay > AV_SYNC_THRESHOLD) ? delay : AV_SYNC_THRESHOLD;
-            // min < delay < max, then delay
-            // delay < min, then min
-            // delay > max, then max
-            sync_threshold = FFMAX(AV_SYNC_THRESHOLD_MIN, FFMIN(AV_SYNC_THRESHOLD_MAX, delay));
-            if (fabs(diff) < AV_NOSYNC_THRESHOLD) {
-                if (diff <= -sync_threshold) { // video play slower than audio, need to get video faster, so the video delay need to be smaller
-                    delay = FFMAX(0, delay + diff);
-                } else if (diff >= sync_threshold && delay > AV_SYNC_FRAMEDUP_THRESHOLD) {//video faster then audio, longer the delay to make video wait audio, as the delay is too big than normal video fram duration, we use delay+diff instead 2*delay, to in case delay too big
-                    delay = delay + diff;
-                } else if (diff >= sync_threshold) {//video faster than audio, and the delay is not too big, so directly double the delay
-                    delay = 2 * delay;
-                }
+            if (live_mode && diff < -LIVE_LATENCY_MAX && vs->pictq_size > 1) {
+                //a newer picture is already waiting, skip this late one
+                vs->live_video_dropped++;
+                pictq_next(vs);
+                schedule_refresh(vs, 1);
+                return;
             }
 
+            delay = video_sync_delay(delay, diff);
+
             vs->frame_timer += delay;
             // fprintf(stdout, "refresh timer delay:%f, vp pts:%f, vs->frame_timer:%f, ref_clock:%f\n", delay, vp->pts, vs->frame_timer, ref_clock);
 
@@ -803,28 +1565,78 @@ void video_refresh_timer(void *userdata) {
 
             // schedule_refresh(vs, 40);
             //show the picture
+            if (framehash_enabled()) {
+                framehash_video(vp->pictYUV, vp->pts);
+            }
+            vs->frames_displayed++;
+            vs->av_drift = diff;
+            trace_begin("display");
             video_display(vs);
+            trace_end("display");
 
 
             // update the read index to next picture
-            if (++vs->pictq_rindex == VIDEO_PICTURE_QUEUE_SIZE) {
-                vs->pictq_rindex = 0;
-            }
+            pictq_next(vs);
+        }
+    }
+}
 
-            SDL_LockMutex(vs->pictq_mutex);
-            vs->pictq_size--;
-            SDL_CondSignal(vs->pictq_cond);
-            SDL_UnlockMutex(vs->pictq_mutex);
+static void toggle_pause(VideoState *vs) {
+    if (!vs->paused) {
+        vs->pause_time = av_gettime_relative();
+        SDL_LockMutex(vs->pause_mutex);
+        vs->paused = 1;
+        SDL_UnlockMutex(vs->pause_mutex);
+        if (vs->audio_stm) {
+            //the callback may wait for a packet, SDL_PauseAudio would wait for the callback
+            packet_queue_set_paused(&vs->audioq, 1);
+            SDL_PauseAudio(1);
         }
     } else {
-        schedule_refresh(vs, 100);
+        //shift the schedule by the paused time, so no frames are rushed out to catch up
+        vs->frame_timer += (av_gettime_relative() - vs->pause_time) / 1000000.0;
+        SDL_LockMutex(vs->pause_mutex);
+        vs->paused = 0;
+        SDL_CondBroadcast(vs->pause_cond);
+        SDL_UnlockMutex(vs->pause_mutex);
+        if (vs->audio_stm) {
+            packet_queue_set_paused(&vs->audioq, 0);
+            SDL_PauseAudio(0);
+        }
+        if (vs->refresh_parked) {
+            vs->refresh_parked = 0;
+            schedule_refresh(vs, 1);
+        }
     }
 }
 
+/* Show the next decoded picture, it is already waiting in the picture queue. */
+static void step_to_next_frame(VideoState *vs) {
+    VideoPicture *vp;
+
+    if (!vs->paused) {
+        toggle_pause(vs);
+    }
+    if (vs->video_stm && vs->pictq_size > 0) {
+        vp = &vs->pict_q[vs->pictq_rindex];
+        if (vp->reverse == vs->reverse) {
+            vs->frame_last_pts = vp->pts;
+            video_display(vs);
+        }
+        pictq_next(vs);
+    }
+
+    //also with an empty picture queue: the demuxer may be parked with too few packets
+    SDL_LockMutex(vs->pause_mutex);
+    SDL_CondBroadcast(vs->pause_cond);
+    SDL_UnlockMutex(vs->pause_mutex);
+}
+
 static Uint32 sdl_refresh_timer_cb (Uint32 interval, void *opaque) {
     SDL_Event event;
     SDL_zero(event);
 
+    thread_sched_enter(THREAD_TIMER);
     event.type = FF_REFRESH_EVENT;
     event.user.data1 = opaque;
     SDL_PushEvent(&event);
@@ -850,6 +1662,10 @@ int allocate_sdlwindow(void *userdata) {
 
     int ret = -1;
     if (vs->video_stm) {
+        if (SDL_InitSubSystem(SDL_INIT_VIDEO | SDL_INIT_TIMER) != 0) {
+            fprintf(stderr, "SDL video init error:%s\n", SDL_GetError());
+            return -1;
+        }
         sdlWindow = SDL_CreateWindow("sdl-ffmpeg player",
         SDL_WINDOWPOS_CENTERED,
         SDL_WINDOWPOS_CENTERED,
@@ -868,6 +1684,9 @@ int allocate_sdlwindow(void *userdata) {
         fprintf(stderr, "SDL_CreateTexture error:%s\n",SDL_GetError());
         return -1;
     }
+    texture_width = vs->video_stm->codecpar->width;
+    texture_height = vs->video_stm->codecpar->height;
+        schedule_refresh(vs, 40);
         SDL_CondSignal(sdlWindow_alloc_cond);
         ret = 0;
     }
@@ -898,9 +1717,9 @@ double get_audio_clock(VideoState *vs) {
     pts = vs->audio_clock; //updated in the audio thread(audio_decode_frame)
     hw_buf_size = vs->audio_buf_size - vs->audio_buf_index;
     bytes_per_sec = 0;
-    n = vs->audio_stm->codecpar->channels * 2; // ?? why multiply 2 here?
+    n = audio_channels * 2; // 2 bytes per S16 sample
     if (vs->audio_stm) {
-        bytes_per_sec = vs->audio_stm->codecpar->sample_rate * n;
+        bytes_per_sec = audio_hw_freq * n;
     }
 
     if (bytes_per_sec) {
@@ -918,6 +1737,102 @@ void stream_seek(VideoState *is, int64_t pos, int rel)
     if (!is->seek_req) {
         is->seek_pos = pos;
         is->seek_flags = rel < 0 ? AVSEEK_FLAG_BACKWARD : 0;
+        SDL_LockMutex(is->pause_mutex);
         is->seek_req = 1;
+        SDL_CondBroadcast(is->pause_cond);
+        SDL_UnlockMutex(is->pause_mutex);
+    }
+}
+
+void stream_cycle_audio(VideoState *vs)
+{
+    if (vs->audio_stm && !vs->audio_switch_req) {
+        SDL_LockMutex(vs->pause_mutex);
+        vs->audio_switch_req = 1;
+        SDL_CondBroadcast(vs->pause_cond);
+        SDL_UnlockMutex(vs->pause_mutex);
+    }
+}
+
+static void bench_account(VideoState *vs, const AVPacket *pkt, int used) {
+    int64_t now;
+
+    vs->bench_read_pkts++;
+    vs->bench_read_bytes += pkt->size;
+    if (!used) {
+        vs->bench_unused_pkts++;
+        vs->bench_unused_bytes += pkt->size;
+    }
+
+    now = av_gettime_relative();
+    if (now - vs->bench_last >= 1000000) {
+        vs->bench_last = now;
+        bench_report(vs, 0);
+    }
+}
+
+/* Unused packets only reach us when discarding is off (-nodiscard) or the demuxer ignores it,
+ * so comparing a run with and without -nodiscard gives the work saved. */
+static void bench_report(VideoState *vs, int final) {
+    double elapsed = (av_gettime_relative() - vs->bench_start) / 1000000.0;
+
+    if (elapsed <= 0) {
+        return;
+    }
+    fprintf(stderr, "%s demux %.1fs: read %.1f pkt/s %.1f KB/s, unused %.1f pkt/s %.1f KB/s (%s)\n",
+            final ? "bench total" : "bench",
+            elapsed,
+            vs->bench_read_pkts / elapsed, vs->bench_read_bytes / elapsed / 1024.0,
+            vs->bench_unused_pkts / elapsed, vs->bench_unused_bytes / elapsed / 1024.0,
+            discard_unused ? "discard on" : "discard off");
+    fprintf(stderr, "bench pictures: %d buffers allocated, packets: %d queue nodes allocated\n",
+            frame_pool_allocations(), packet_node_allocations());
+    if (final) {
+        mem_budget_report(stderr);
+    }
+}
+
+/* Time from a packet leaving the demuxer to it being heard/shown. For a real time source
+ * packets arrive at the pace they were captured, so this is the latency we add on top of
+ * the network and the capture device. */
+static double get_live_latency(VideoState *vs) {
+    double clock;
+
+    if (0 == vs->live_last_time) {
+        return 0;
+    }
+    if (vs->audio_stm) {
+        clock = get_audio_clock(vs);
+        if (audio_hw_freq > 0) {
+            clock -= (double)audio_hw_buf_size / (audio_hw_freq * audio_channels * 2);
+        }
+    } else {
+        clock = vs->frame_last_pts;
+    }
+    return vs->live_last_pts - clock + (av_gettime_relative() - vs->live_last_time) / 1000000.0;
+}
+
+static void live_report(VideoState *vs, int final) {
+    int64_t now = av_gettime_relative();
+    double latency = get_live_latency(vs);
+
+    if (vs->audio_stm || vs->frame_last_pts > 0) {
+        vs->live_latency_sum += latency;
+        vs->live_latency_count++;
+        if (latency > vs->live_latency_max) {
+            vs->live_latency_max = latency;
+        }
+    }
+    if (!final && now - vs->live_report_time < 1000000) {
+        return;
+    }
+    vs->live_report_time = now;
+    if (vs->live_latency_count > 0) {
+        fprintf(stderr, "%s latency: now %.0f ms, avg %.0f ms, max %.0f ms, dropped audio pkts %d, video pictures %d\n",
+                final ? "live total" : "live",
+                latency * 1000,
+                vs->live_latency_sum / vs->live_latency_count * 1000,
+                vs->live_latency_max * 1000,
+                vs->live_audio_dropped, vs->live_video_dropped);
     }
 }
@@ -0,0 +1,103 @@
+#include <SDL2/SDL.h>
+#include "membudget.h"
+
+typedef struct MemBudget {
+    SDL_SpinLock lock;
+    int64_t cap;
+    int64_t total, total_peak;
+    int64_t live[MEM_CATEGORY_NB];
+    int64_t peak[MEM_CATEGORY_NB];
+}MemBudget;
+
+static MemBudget budget;
+
+static const char *category_names[MEM_CATEGORY_NB] = {
+    "packets",
+    "pictures",
+    "audio",
+    "reverse",
+    "mosaic",
+    "waveform",
+};
+
+void mem_budget_set_cap(int64_t bytes) {
+    budget.cap = bytes;
+}
+
+int64_t mem_budget_cap(void) {
+    return budget.cap;
+}
+
+void mem_budget_add(MemCategory cat, int64_t bytes) {
+    SDL_AtomicLock(&budget.lock);
+    budget.live[cat] += bytes;
+    if (budget.live[cat] > budget.peak[cat]) {
+        budget.peak[cat] = budget.live[cat];
+    }
+    budget.total += bytes;
+    if (budget.total > budget.total_peak) {
+        budget.total_peak = budget.total;
+    }
+    SDL_AtomicUnlock(&budget.lock);
+}
+
+void mem_budget_sub(MemCategory cat, int64_t bytes) {
+    SDL_AtomicLock(&budget.lock);
+    budget.live[cat] -= bytes;
+    budget.total -= bytes;
+    SDL_AtomicUnlock(&budget.lock);
+}
+
+//single 64 bit reads may tear on 32 bit hosts, so readers take the lock too
+int64_t mem_budget_live(MemCategory cat) {
+    int64_t value;
+    SDL_AtomicLock(&budget.lock);
+    value = budget.live[cat];
+    SDL_AtomicUnlock(&budget.lock);
+    return value;
+}
+
+int64_t mem_budget_peak(MemCategory cat) {
+    int64_t value;
+    SDL_AtomicLock(&budget.lock);
+    value = budget.peak[cat];
+    SDL_AtomicUnlock(&budget.lock);
+    return value;
+}
+
+int64_t mem_budget_total(void) {
+    int64_t value;
+    SDL_AtomicLock(&budget.lock);
+    value = budget.total;
+    SDL_AtomicUnlock(&budget.lock);
+    return value;
+}
+
+int mem_budget_exceeded(void) {
+    return budget.cap > 0 && mem_budget_total() > budget.cap;
+}
+
+const char *mem_budget_name(MemCategory cat) {
+    return category_names[cat];
+}
+
+//printed from a copy, the audio callback and the demuxer take the lock for every packet
+void mem_budget_report(FILE *out) {
+    MemBudget copy;
+    int i;
+
+    SDL_AtomicLock(&budget.lock);
+    copy = budget;
+    SDL_AtomicUnlock(&budget.lock);
+
+    fprintf(out, "memory: total %.1f KB, peak %.1f KB, cap %s",
+            copy.total / 1024.0, copy.total_peak / 1024.0, copy.cap > 0 ? "" : "none");
+    if (copy.cap > 0) {
+        fprintf(out, "%.1f KB", copy.cap / 1024.0);
+    }
+    fprintf(out, "\n");
+    for (i = 0; i < MEM_CATEGORY_NB; i++) {
+        fprintf(out, "  %-9s live %10.1f KB  peak %10.1f KB\n",
+                category_names[i], copy.live[i] / 1024.0, copy.peak[i] / 1024.0);
+    }
+}
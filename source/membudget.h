@@ -0,0 +1,40 @@
+#ifndef MEMBUDGET_H
+#define MEMBUDGET_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* Accounting of every buffer the player allocates itself. Buffers inside ffmpeg and SDL
+ * (decoder reference frames, demuxer buffers) are not counted. */
+typedef enum MemCategory {
+    MEM_PACKETS,    //packet queue nodes and payloads
+    MEM_PICTURES,   //converted frames of the picture queue
+    MEM_AUDIO,      //decoded audio waiting for the audio callback
+    MEM_REVERSE,    //GOP buffers of the reverse playback
+    MEM_MOSAIC,     //the shared picture atlas of the mosaic mode
+    MEM_WAVEFORM,   //the bins of the waveform overview
+    MEM_CATEGORY_NB
+}MemCategory;
+
+//0 means no cap
+void mem_budget_set_cap(int64_t bytes);
+
+int64_t mem_budget_cap(void);
+
+void mem_budget_add(MemCategory cat, int64_t bytes);
+
+void mem_budget_sub(MemCategory cat, int64_t bytes);
+
+int64_t mem_budget_live(MemCategory cat);
+
+int64_t mem_budget_peak(MemCategory cat);
+
+int64_t mem_budget_total(void);
+
+int mem_budget_exceeded(void);
+
+const char *mem_budget_name(MemCategory cat);
+
+void mem_budget_report(FILE *out);
+
+#endif
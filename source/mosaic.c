@@ -0,0 +1,620 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <libavutil/time.h>
+#include <libavutil/imgutils.h>
+#include "videoutils.h"
+#include "threadsched.h"
+#include "trace.h"
+#include "taskpool.h"
+
+/*
+ * Mosaic mode, many streams in one window.
+ *
+ * Every tile has its own pipeline thread that demuxes, decodes and converts one source,
+ * looping it at the end. The converter scales into a staging picture of the tile's size,
+ * outside any lock, and only the copy into the tile of the shared YUV 4:2:0 atlas is done
+ * under the tile's lock, so nothing full size is ever copied. The main thread is the only
+ * compositor: once per vsync it uploads the atlas into one texture, if a tile changed, and
+ * presents it. A window, texture and present per source would each wait for the vsync.
+ *
+ * The atlas is double buffered. Converters write the back buffer, the compositor swaps it
+ * to the front under a short write lock and uploads the front without any lock, then copies
+ * the tiles that changed into the new back buffer so it does not go back in time.
+ *
+ * With -pool the pipelines have no threads of their own: decoding the next frame and showing
+ * it when due are tasks on one work stealing pool with a worker per cpu, see taskpool.h.
+ *
+ * A frame converted more than a frame duration after its time is dropped instead, so a
+ * pipeline that cannot keep up shows up as dropped frames, not as a stream that slowly
+ * falls behind. The report tells how many sources of which size the box sustains.
+ */
+#define MOSAIC_PIX_FMT AV_PIX_FMT_YUV420P
+#define MOSAIC_TILE_ALIGN 32 //tile origins stay aligned for the converters
+#define MOSAIC_MAX_STILL 500000 //microseconds, a late tile is still refreshed this often
+#define MOSAIC_MAX_DROPPED 0.01 //a source keeps up below this share of dropped frames
+
+typedef struct MosaicSource {
+    struct MosaicContext *ctx;
+    const char *path;
+    int x, y; //tile origin in the atlas
+    SDL_Thread *tid;
+    int width, height; //of the stream
+    //picture position inside the tile, letterboxed
+    int pic_x, pic_y, pic_w, pic_h;
+    int src_w, src_h;
+    //the pipeline, used by one thread or one pool task at a time
+    AVFormatContext *fmt_ctx;
+    AVCodecContext *codecCtx;
+    int stream_index;
+    AVFrame *frame;
+    int has_frame; //decoded, waiting to be due
+    ScalerCache scalers;
+    uint8_t *staging[4]; //the scaled picture, pic_w x pic_h, accounted as MEM_MOSAIC
+    int staging_linesize[4];
+    int staging_size;
+    //the timeline: a frame of pts is due at base_time + pts - base_pts
+    int64_t base_time, due, last_due, last_shown;
+    double base_pts, last_pts, frame_duration;
+    int rebase;
+    //written by the pipeline only
+    int64_t decoded, shown, dropped;
+    int64_t max_late; //microseconds
+    int failed;
+    //the tile in each atlas buffer: conversion it holds, taken while writing or copying it
+    int64_t tile_gen[2];
+    int64_t gen;
+    SDL_SpinLock tile_lock;
+}MosaicSource;
+
+typedef struct MosaicContext {
+    const MosaicOptions *opts;
+    MosaicSource *sources;
+    int nb_sources;
+    int tile_w, tile_h, columns, rows;
+    //the atlas buffers, tiles are written into data[back] under the shared lock,
+    //the swap takes it alone. Writers are preferred, a swap is not held off by converters
+    uint8_t *data[2][4];
+    int linesize[4];
+    int back;
+    int width, height;
+    int data_size; //of one buffer, both are accounted as MEM_MOSAIC
+    pthread_rwlock_t lock;
+    SDL_atomic_t dirty;
+    TaskPool *pool; //NULL with a thread per source
+    volatile int quit;
+}MosaicContext;
+
+static void mosaic_clear(MosaicContext *mc, int buf, int x, int y, int w, int h) {
+    int p, row;
+    for (p = 0; p < 3; p++) {
+        int shift = p ? 1 : 0;
+        for (row = y >> shift; row < (y + h) >> shift; row++) {
+            memset(mc->data[buf][p] + row * mc->linesize[p] + (x >> shift), p ? 128 : 16, w >> shift);
+        }
+    }
+}
+
+//bring the tile in the back buffer up to the front one, unless its converter got further
+static void mosaic_catch_up(MosaicContext *mc, MosaicSource *src) {
+    int front = !mc->back;
+    int p;
+
+    SDL_AtomicLock(&src->tile_lock);
+    if (src->tile_gen[front] > src->tile_gen[mc->back]) {
+        for (p = 0; p < 3; p++) {
+            int shift = p ? 1 : 0;
+            int offset = (src->y >> shift) * mc->linesize[p] + (src->x >> shift);
+            av_image_copy_plane(mc->data[mc->back][p] + offset, mc->linesize[p],
+                                mc->data[front][p] + offset, mc->linesize[p],
+                                mc->tile_w >> shift, mc->tile_h >> shift);
+        }
+        src->tile_gen[mc->back] = src->tile_gen[front];
+    }
+    SDL_AtomicUnlock(&src->tile_lock);
+}
+
+//fit the picture into the tile with its aspect ratio, even offsets and sizes for 4:2:0
+static void mosaic_layout(MosaicSource *src, const AVFrame *frame, AVRational sar) {
+    MosaicContext *mc = src->ctx;
+    double aspect = (double)frame->width / frame->height;
+
+    if (sar.num > 0 && sar.den > 0) {
+        aspect *= av_q2d(sar);
+    }
+    src->pic_w = mc->tile_w;
+    src->pic_h = FFALIGN((int)(mc->tile_w / aspect), 2);
+    if (src->pic_h > mc->tile_h) {
+        src->pic_h = mc->tile_h;
+        src->pic_w = FFALIGN((int)(mc->tile_h * aspect), 2);
+    }
+    src->pic_w = av_clip(src->pic_w, 2, mc->tile_w);
+    src->pic_h = av_clip(src->pic_h, 2, mc->tile_h);
+    src->pic_x = ((mc->tile_w - src->pic_w) / 2) & ~1;
+    src->pic_y = ((mc->tile_h - src->pic_h) / 2) & ~1;
+    src->src_w = frame->width;
+    src->src_h = frame->height;
+}
+
+static void mosaic_staging_free(MosaicSource *src) {
+    av_freep(&src->staging[0]);
+    mem_budget_sub(MEM_MOSAIC, src->staging_size);
+    src->staging_size = 0;
+}
+
+static void mosaic_convert(MosaicSource *src, ScalerCache *scalers, AVFrame *frame, AVRational sar) {
+    MosaicContext *mc = src->ctx;
+    struct SwsContext *sws_ctx;
+    int relayout = frame->width != src->src_w || frame->height != src->src_h;
+    int p, x, y;
+
+    //the tile's layout and staging picture belong to this pipeline, no lock needed
+    if (relayout) {
+        mosaic_layout(src, frame, sar);
+        mosaic_staging_free(src);
+        src->staging_size = av_image_alloc(src->staging, src->staging_linesize, src->pic_w, src->pic_h,
+                                           MOSAIC_PIX_FMT, FRAME_POOL_ALIGN);
+        if (src->staging_size < 0) {
+            src->staging_size = 0;
+            src->staging[0] = NULL;
+        }
+        mem_budget_add(MEM_MOSAIC, src->staging_size);
+    }
+    sws_ctx = scaler_cache_get(scalers, frame->width, frame->height, frame->format,
+                               src->pic_w, src->pic_h, MOSAIC_PIX_FMT);
+    if (sws_ctx && src->staging[0]) {
+        sws_scale(sws_ctx, (uint8_t const * const *)frame->data, frame->linesize,
+                  0, frame->height, src->staging, src->staging_linesize);
+    }
+
+    //tiles do not overlap, the converters never wait for each other, only for the compositor
+    pthread_rwlock_rdlock(&mc->lock);
+    SDL_AtomicLock(&src->tile_lock);
+    if (relayout) {
+        mosaic_clear(mc, mc->back, src->x, src->y, mc->tile_w, mc->tile_h);
+    }
+    if (sws_ctx && src->staging[0]) {
+        x = src->x + src->pic_x;
+        y = src->y + src->pic_y;
+        for (p = 0; p < 3; p++) {
+            int shift = p ? 1 : 0;
+            av_image_copy_plane(mc->data[mc->back][p] + (y >> shift) * mc->linesize[p] + (x >> shift),
+                                mc->linesize[p], src->staging[p], src->staging_linesize[p],
+                                src->pic_w >> shift, src->pic_h >> shift);
+        }
+        src->tile_gen[mc->back] = ++src->gen;
+        SDL_AtomicSet(&mc->dirty, 1);
+    }
+    SDL_AtomicUnlock(&src->tile_lock);
+    pthread_rwlock_unlock(&mc->lock);
+}
+
+static int mosaic_source_open(MosaicSource *src) {
+    AVStream *st;
+    int i;
+
+    memset(&src->scalers, 0, sizeof(src->scalers));
+    src->stream_index = -1;
+    src->frame = av_frame_alloc();
+    if (NULL == src->frame ||
+            avformat_open_input(&src->fmt_ctx, src->path, NULL, NULL) < 0 ||
+            avformat_find_stream_info(src->fmt_ctx, NULL) < 0 ||
+            open_codec_context(src->fmt_ctx, &src->stream_index, &src->codecCtx, AVMEDIA_TYPE_VIDEO) < 0) {
+        fprintf(stderr, "%s: no decodable video\n", src->path);
+        src->failed = 1;
+        return -1;
+    }
+    for (i = 0; i < (int)src->fmt_ctx->nb_streams; i++) {
+        if (i != src->stream_index) {
+            src->fmt_ctx->streams[i]->discard = AVDISCARD_ALL;
+        }
+    }
+    st = src->fmt_ctx->streams[src->stream_index];
+    src->width = src->codecCtx->width;
+    src->height = src->codecCtx->height;
+    src->frame_duration = 0.04;
+    if (st->avg_frame_rate.num > 0 && st->avg_frame_rate.den > 0) {
+        src->frame_duration = 1 / av_q2d(st->avg_frame_rate);
+    }
+    src->base_time = src->last_due = av_gettime_relative();
+    src->rebase = 1;
+    return 0;
+}
+
+static void mosaic_source_close(MosaicSource *src) {
+    av_frame_free(&src->frame);
+    mosaic_staging_free(src);
+    scaler_cache_free(&src->scalers);
+    avcodec_free_context(&src->codecCtx);
+    if (src->fmt_ctx) {
+        avformat_close_input(&src->fmt_ctx);
+    }
+}
+
+/* The next frame of the source into src->frame, and when it is due. Loops the source at its
+ * end, the timeline goes on after the last frame. */
+static int mosaic_source_decode(MosaicSource *src) {
+    MosaicContext *mc = src->ctx;
+    AVFormatContext *fmt_ctx = src->fmt_ctx;
+    AVStream *st = fmt_ctx->streams[src->stream_index];
+    AVPacket packet;
+    int ret;
+
+    av_init_packet(&packet);
+    packet.data = NULL;
+    packet.size = 0;
+    while (!mc->quit) {
+        if (avcodec_receive_frame(src->codecCtx, src->frame) == 0) {
+            AVFrame *frame = src->frame;
+            double pts = frame->best_effort_timestamp != AV_NOPTS_VALUE ?
+                         frame->best_effort_timestamp * av_q2d(st->time_base) : src->last_pts + src->frame_duration;
+
+            src->decoded++;
+            if (src->rebase || pts < src->last_pts || pts - src->last_pts > 10) {
+                //first frame, a loop or a timestamp jump
+                if (!src->rebase) {
+                    src->base_time = src->last_due + (int64_t)(src->frame_duration * 1000000);
+                }
+                src->base_pts = pts;
+                src->rebase = 0;
+            } else if (pts > src->last_pts) {
+                src->frame_duration = FFMIN(pts - src->last_pts, 1.0);
+            }
+            src->last_pts = pts;
+            src->due = src->base_time + (int64_t)((pts - src->base_pts) * 1000000);
+            src->last_due = src->due;
+            return 0;
+        }
+
+        trace_begin("demux_read");
+        ret = av_read_frame(fmt_ctx, &packet);
+        trace_end("demux_read");
+        if (ret < 0) {
+            if (ret != AVERROR_EOF || av_seek_frame(fmt_ctx, -1, fmt_ctx->start_time != AV_NOPTS_VALUE ? fmt_ctx->start_time : 0,
+                              AVSEEK_FLAG_BACKWARD) < 0) {
+                return -1;
+            }
+            avcodec_flush_buffers(src->codecCtx);
+            src->base_time = src->last_due + (int64_t)(src->frame_duration * 1000000);
+            src->rebase = 1;
+            continue;
+        }
+        if (packet.stream_index != src->stream_index) {
+            av_packet_unref(&packet);
+            continue;
+        }
+        trace_begin("decoder_send");
+        avcodec_send_packet(src->codecCtx, &packet);
+        trace_end("decoder_send");
+        av_packet_unref(&packet);
+    }
+    return -1;
+}
+
+//convert src->frame into the tile, or drop it when it is too late
+static void mosaic_source_show(MosaicSource *src, int64_t now) {
+    AVFrame *frame = src->frame;
+    AVStream *st = src->fmt_ctx->streams[src->stream_index];
+
+    src->max_late = FFMAX(src->max_late, now - src->due);
+    if (now - src->due > src->frame_duration * 1000000 && now - src->last_shown < MOSAIC_MAX_STILL) {
+        src->dropped++;
+    } else {
+        trace_begin("tile_convert");
+        mosaic_convert(src, &src->scalers, frame, frame->sample_aspect_ratio.num ?
+                       frame->sample_aspect_ratio : st->sample_aspect_ratio);
+        trace_end("tile_convert");
+        src->shown++;
+        src->last_shown = now;
+    }
+    av_frame_unref(frame);
+}
+
+static int mosaic_source_thread(void *userdata) {
+    MosaicSource *src = (MosaicSource *)userdata;
+    MosaicContext *mc = src->ctx;
+    int64_t now;
+
+    thread_sched_enter(THREAD_VIDEO);
+    trace_thread_name("mosaic_source");
+    if (mosaic_source_open(src) == 0) {
+        while (!mc->quit && mosaic_source_decode(src) == 0) {
+            now = av_gettime_relative();
+            while (src->due > now && !mc->quit) {
+                av_usleep(FFMIN(src->due - now, 100000));
+                now = av_gettime_relative();
+            }
+            mosaic_source_show(src, now);
+        }
+    }
+    mosaic_source_close(src);
+    return 0;
+}
+
+/* A source on the shared pool: decode the next frame as soon as a worker is free, show it
+ * once it is due. Both steps carry the due time as deadline, so with more work than cores
+ * the source furthest behind its presentation clock is served first. */
+static void mosaic_source_task(void *arg) {
+    MosaicSource *src = (MosaicSource *)arg;
+    MosaicContext *mc = src->ctx;
+    int64_t now;
+
+    if (mc->quit) {
+        return;
+    }
+    if (NULL == src->fmt_ctx && mosaic_source_open(src) < 0) {
+        return;
+    }
+    if (!src->has_frame) {
+        if (mosaic_source_decode(src) < 0) {
+            return;
+        }
+        src->has_frame = 1;
+    }
+    now = av_gettime_relative();
+    if (src->due > now) {
+        task_pool_submit(mc->pool, mosaic_source_task, src, src->due, src->due);
+        return;
+    }
+    mosaic_source_show(src, now);
+    src->has_frame = 0;
+    task_pool_submit(mc->pool, mosaic_source_task, src, src->due + (int64_t)(src->frame_duration * 1000000), 0);
+}
+
+static void mosaic_report(MosaicContext *mc, double elapsed, int presents, int uploads, int64_t upload_time,
+                          int64_t *last_decoded, int final) {
+    int64_t decoded = 0, dropped = 0;
+    int i, keeping_up = 0, running = 0;
+
+    for (i = 0; i < mc->nb_sources; i++) {
+        MosaicSource *src = &mc->sources[i];
+        if (src->failed) {
+            continue;
+        }
+        running++;
+        decoded += src->decoded;
+        dropped += src->dropped;
+        if (src->decoded > 0 && src->dropped <= src->decoded * MOSAIC_MAX_DROPPED) {
+            keeping_up++;
+        }
+    }
+    if (!final) {
+        fprintf(stderr, "mosaic: %d presents/s, %d uploads %.2f ms, %.1f decoded fps, %d/%d sources keep up\n",
+                (int)(presents / elapsed + 0.5), uploads, uploads ? upload_time / 1000.0 / uploads : 0,
+                (decoded - *last_decoded) / elapsed, keeping_up, running);
+        *last_decoded = decoded;
+        return;
+    }
+
+    fprintf(stderr, "mosaic: %d sources in %dx%d tiles of a %dx%d atlas, %.1fs\n",
+            mc->nb_sources, mc->tile_w, mc->tile_h, mc->width, mc->height, elapsed);
+    for (i = 0; i < mc->nb_sources; i++) {
+        MosaicSource *src = &mc->sources[i];
+        if (src->failed) {
+            fprintf(stderr, "  %2d %s: failed\n", i, src->path);
+            continue;
+        }
+        fprintf(stderr, "  %2d %s %dx%d: %"PRId64" decoded, %"PRId64" shown, %"PRId64" dropped, max late %.1f ms\n",
+                i, src->path, src->width, src->height, src->decoded, src->shown, src->dropped,
+                src->max_late / 1000.0);
+    }
+    fprintf(stderr, "mosaic: %d of %d sources kept up (under %.0f%% dropped), %.1f decoded fps, "
+                    "%.1f presents/s, %d uploads %.2f ms each\n",
+            keeping_up, running, MOSAIC_MAX_DROPPED * 100, decoded / elapsed, presents / elapsed,
+            uploads, uploads ? upload_time / 1000.0 / uploads : 0);
+}
+
+int mosaic_run(char **files, int nb_files, const MosaicOptions *opts) {
+    MosaicContext mc;
+    SDL_Window *window = NULL;
+    SDL_Renderer *renderer = NULL;
+    SDL_Texture *atlas = NULL;
+    SDL_RendererInfo info;
+    SDL_DisplayMode mode;
+    SDL_Event event;
+    int64_t start, now, report_time, upload_time = 0, last_decoded = 0;
+    int64_t total_upload_time = 0;
+    int presents = 0, uploads = 0, total_presents = 0, total_uploads = 0;
+    int frame_delay = 0;
+    pthread_rwlockattr_t lock_attr;
+    int i, ret = 0;
+
+    memset(&mc, 0, sizeof(mc));
+    mc.opts = opts;
+    mc.nb_sources = opts->count;
+    mc.columns = opts->columns > 0 ? opts->columns : (int)ceil(sqrt(opts->count));
+    mc.rows = (opts->count + mc.columns - 1) / mc.columns;
+    mc.tile_w = FFALIGN(opts->tile_width, MOSAIC_TILE_ALIGN);
+    mc.tile_h = FFALIGN(mc.tile_w * 9 / 16, 2);
+    mc.width = mc.tile_w * mc.columns;
+    mc.height = mc.tile_h * mc.rows;
+    pthread_rwlockattr_init(&lock_attr);
+#ifdef __GLIBC__
+    //the default lets a steady stream of converters hold off the swap for good
+    pthread_rwlockattr_setkind_np(&lock_attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+    pthread_rwlock_init(&mc.lock, &lock_attr);
+    pthread_rwlockattr_destroy(&lock_attr);
+
+    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS) != 0) {
+        fprintf(stderr, "SDL_Init Error:%s\n", SDL_GetError());
+        ret = -1;
+        goto done;
+    }
+    window = SDL_CreateWindow("sdl-ffmpeg mosaic", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+                              mc.width, mc.height, SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
+    renderer = window ? SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC) : NULL;
+    if (NULL == renderer) {
+        fprintf(stderr, "SDL_CreateRenderer error:%s\n", SDL_GetError());
+        ret = -1;
+        goto done;
+    }
+    SDL_GetRendererInfo(renderer, &info);
+    if ((info.max_texture_width && mc.width > info.max_texture_width) ||
+            (info.max_texture_height && mc.height > info.max_texture_height)) {
+        fprintf(stderr, "A %dx%d atlas is over the %dx%d texture limit, use a smaller -tilewidth\n",
+                mc.width, mc.height, info.max_texture_width, info.max_texture_height);
+        ret = -1;
+        goto done;
+    }
+    atlas = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_IYUV, SDL_TEXTUREACCESS_STREAMING, mc.width, mc.height);
+    if (NULL == atlas) {
+        fprintf(stderr, "SDL_CreateTexture error:%s\n", SDL_GetError());
+        ret = -1;
+        goto done;
+    }
+    if (!(info.flags & SDL_RENDERER_PRESENTVSYNC)) {
+        //no vsync to wait for, pace the presents to the refresh rate ourselves
+        frame_delay = 1000 / (SDL_GetCurrentDisplayMode(0, &mode) == 0 && mode.refresh_rate > 0 ? mode.refresh_rate : 60);
+    }
+
+    for (i = 0; i < 2; i++) {
+        int size = av_image_alloc(mc.data[i], mc.linesize, mc.width, mc.height, MOSAIC_PIX_FMT, FRAME_POOL_ALIGN);
+        if (size < 0) {
+            ret = AVERROR(ENOMEM);
+            goto done;
+        }
+        mc.data_size = size;
+        mem_budget_add(MEM_MOSAIC, size);
+        mosaic_clear(&mc, i, 0, 0, mc.width, mc.height);
+    }
+    SDL_AtomicSet(&mc.dirty, 1);
+
+    mc.sources = av_mallocz_array(mc.nb_sources, sizeof(MosaicSource));
+    if (NULL == mc.sources) {
+        ret = AVERROR(ENOMEM);
+        goto done;
+    }
+    if (opts->pool) {
+        mc.pool = task_pool_create(opts->threads);
+        if (NULL == mc.pool) {
+            ret = -1;
+            goto done;
+        }
+        fprintf(stderr, "mosaic: %d sources on a pool of %d workers\n", mc.nb_sources, task_pool_workers(mc.pool));
+    }
+    for (i = 0; i < mc.nb_sources; i++) {
+        MosaicSource *src = &mc.sources[i];
+        src->ctx = &mc;
+        //fewer files than tiles repeat them
+        src->path = files[i % nb_files];
+        src->x = (i % mc.columns) * mc.tile_w;
+        src->y = (i / mc.columns) * mc.tile_h;
+        if (mc.pool) {
+            task_pool_submit(mc.pool, mosaic_source_task, src, av_gettime_relative(), 0);
+            continue;
+        }
+        src->tid = SDL_CreateThread(mosaic_source_thread, "mosaic_source", src);
+        if (NULL == src->tid) {
+            fprintf(stderr, "Could not start the pipeline of tile %d\n", i);
+            src->failed = 1;
+        }
+    }
+
+    thread_sched_enter(THREAD_PRESENT);
+    trace_thread_name("compositor");
+    start = report_time = av_gettime_relative();
+    while (!mc.quit) {
+        while (SDL_PollEvent(&event)) {
+            if (SDL_QUIT == event.type ||
+                    (SDL_KEYDOWN == event.type &&
+                     (event.key.keysym.sym == SDLK_ESCAPE || event.key.keysym.sym == SDLK_q))) {
+                mc.quit = 1;
+            }
+        }
+        trace_poll();
+
+        if (SDL_AtomicSet(&mc.dirty, 0)) {
+            int64_t begin = av_gettime_relative();
+            int front;
+            trace_begin("atlas_swap");
+            pthread_rwlock_wrlock(&mc.lock);
+            front = mc.back;
+            mc.back = !mc.back;
+            pthread_rwlock_unlock(&mc.lock);
+            trace_end("atlas_swap");
+            //converters only write the back buffer now
+            trace_begin("atlas_upload");
+            SDL_UpdateYUVTexture(atlas, NULL, mc.data[front][0], mc.linesize[0], mc.data[front][1], mc.linesize[1],
+                                 mc.data[front][2], mc.linesize[2]);
+            trace_end("atlas_upload");
+            if (mc.sources) {
+                for (i = 0; i < mc.nb_sources; i++) {
+                    mosaic_catch_up(&mc, &mc.sources[i]);
+                }
+            }
+            upload_time += av_gettime_relative() - begin;
+            uploads++;
+        }
+        trace_begin("present");
+        SDL_RenderClear(renderer);
+        SDL_RenderCopy(renderer, atlas, NULL, NULL);
+        SDL_RenderPresent(renderer);
+        trace_end("present");
+        presents++;
+        if (frame_delay) {
+            SDL_Delay(frame_delay);
+        }
+
+        now = av_gettime_relative();
+        if (now - report_time >= 1000000) {
+            mosaic_report(&mc, (now - report_time) / 1000000.0, presents, uploads, upload_time, &last_decoded, 0);
+            total_presents += presents;
+            total_uploads += uploads;
+            total_upload_time += upload_time;
+            presents = uploads = 0;
+            upload_time = 0;
+            report_time = now;
+        }
+        if (opts->duration > 0 && now - start >= (int64_t)opts->duration * 1000000) {
+            mc.quit = 1;
+        }
+    }
+    total_presents += presents;
+    total_uploads += uploads;
+    total_upload_time += upload_time;
+
+    if (mc.pool) {
+        task_pool_report(mc.pool, stderr);
+        task_pool_destroy(&mc.pool);
+    }
+    for (i = 0; i < mc.nb_sources; i++) {
+        if (mc.sources[i].tid) {
+            SDL_WaitThread(mc.sources[i].tid, NULL);
+        }
+    }
+    mosaic_report(&mc, (av_gettime_relative() - start) / 1000000.0, total_presents, total_uploads,
+                  total_upload_time, &last_decoded, 1);
+
+    done:
+        mc.quit = 1;
+        task_pool_destroy(&mc.pool);
+        if (mc.sources && opts->pool) {
+            //the pool is gone, nothing uses the pipelines any more
+            for (i = 0; i < mc.nb_sources; i++) {
+                mosaic_source_close(&mc.sources[i]);
+            }
+        }
+        for (i = 0; i < 2; i++) {
+            if (mc.data[i][0]) {
+                av_freep(&mc.data[i][0]);
+                mem_budget_sub(MEM_MOSAIC, mc.data_size);
+            }
+        }
+        av_free(mc.sources);
+        pthread_rwlock_destroy(&mc.lock);
+        if (atlas) {
+            SDL_DestroyTexture(atlas);
+        }
+        if (renderer) {
+            SDL_DestroyRenderer(renderer);
+        }
+        if (window) {
+            SDL_DestroyWindow(window);
+        }
+        SDL_Quit();
+    return ret;
+}
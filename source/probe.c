@@ -0,0 +1,374 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <libavutil/avstring.h>
+#include <libavutil/bprint.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/time.h>
+#include "videoutils.h"
+
+/*
+ * Headless probe mode.
+ *
+ * Prints a JSON array with the container, duration and streams of every file, in the order
+ * given. Files are opened and their streams analysed by a pool of workers; no decoder is
+ * opened, the stream parameters already tell codecs, sizes and rates.
+ *
+ * Results are cached in a file, keyed by real path, size and modification time. A file that did
+ * not change since it was cached costs a stat. The cache is rewritten at the end with the
+ * entries of this run and the ones of earlier runs that were not touched.
+ *
+ * Cache records: "size mtime_ns path_length\n", the path, "\n", the JSON, "\n".
+ */
+#define PROBE_CACHE_HEADER "#probe-cache 1\n"
+
+typedef struct ProbeEntry {
+    char *path;
+    int64_t size, mtime;
+    char *json;
+    int used; //replaced or confirmed by this run, not written again as an old entry
+}ProbeEntry;
+
+typedef struct ProbeFile {
+    const char *path; //as given, and printed
+    char *key; //the real path, the cache key, from realpath()
+    int64_t size, mtime;
+    char *json;
+    int cached, failed;
+}ProbeFile;
+
+typedef struct ProbeContext {
+    ProbeFile *files;
+    int nb_files;
+    ProbeEntry *cache; //sorted by path, read only while the workers run
+    int nb_cache;
+    SDL_atomic_t next_file;
+}ProbeContext;
+
+static int64_t probe_mtime(const struct stat *st) {
+#ifdef __linux__
+    return st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+#else
+    return st->st_mtime * 1000000000LL;
+#endif
+}
+
+static int probe_entry_cmp(const void *a, const void *b) {
+    return strcmp(((const ProbeEntry *)a)->path, ((const ProbeEntry *)b)->path);
+}
+
+static void probe_cache_free(ProbeContext *pc) {
+    int i;
+    for (i = 0; i < pc->nb_cache; i++) {
+        av_free(pc->cache[i].path);
+        av_free(pc->cache[i].json);
+    }
+    av_freep(&pc->cache);
+    pc->nb_cache = 0;
+}
+
+//a missing or unreadable cache is an empty one
+static void probe_cache_load(ProbeContext *pc, const char *path) {
+    FILE *in = fopen(path, "r");
+    char header[64];
+    char *line = NULL;
+    size_t line_alloc = 0;
+    int nb_alloc = 0;
+
+    if (NULL == in) {
+        return;
+    }
+    if (NULL == fgets(header, sizeof(header), in) || strcmp(header, PROBE_CACHE_HEADER)) {
+        fprintf(stderr, "%s is not a probe cache, starting a new one\n", path);
+        fclose(in);
+        return;
+    }
+    for (;;) {
+        ProbeEntry entry;
+        long long size, mtime;
+        size_t path_len;
+        ssize_t len;
+
+        memset(&entry, 0, sizeof(entry));
+        if (fscanf(in, "%lld %lld %zu", &size, &mtime, &path_len) != 3 || fgetc(in) != '\n' ||
+                path_len > 65536 || NULL == (entry.path = av_malloc(path_len + 1)) ||
+                fread(entry.path, 1, path_len, in) != path_len || fgetc(in) != '\n' ||
+                (len = getline(&line, &line_alloc, in)) <= 1) {
+            av_free(entry.path);
+            break;
+        }
+        entry.path[path_len] = '\0';
+        line[len - 1] = '\0';
+        entry.size = size;
+        entry.mtime = mtime;
+        entry.json = av_strdup(line);
+        if (pc->nb_cache == nb_alloc) {
+            ProbeEntry *cache = av_realloc_array(pc->cache, nb_alloc ? nb_alloc * 2 : 1024, sizeof(ProbeEntry));
+            if (NULL == cache) {
+                av_free(entry.path);
+                av_free(entry.json);
+                break;
+            }
+            pc->cache = cache;
+            nb_alloc = nb_alloc ? nb_alloc * 2 : 1024;
+        }
+        pc->cache[pc->nb_cache++] = entry;
+    }
+    free(line);
+    fclose(in);
+    qsort(pc->cache, pc->nb_cache, sizeof(ProbeEntry), probe_entry_cmp);
+}
+
+static ProbeEntry *probe_cache_find(ProbeContext *pc, const char *path) {
+    ProbeEntry key;
+    key.path = (char *)path;
+    return pc->nb_cache ? bsearch(&key, pc->cache, pc->nb_cache, sizeof(ProbeEntry), probe_entry_cmp) : NULL;
+}
+
+static void probe_cache_write_entry(FILE *out, const char *path, int64_t size, int64_t mtime, const char *json) {
+    fprintf(out, "%"PRId64" %"PRId64" %zu\n%s\n%s\n", size, mtime, strlen(path), path, json);
+}
+
+//written next to the old one and renamed over it, a crash never leaves half a cache
+static int probe_cache_save(ProbeContext *pc, const char *path) {
+    char tmp[1024];
+    FILE *out;
+    int i;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    out = fopen(tmp, "w");
+    if (NULL == out) {
+        fprintf(stderr, "Could not write the probe cache %s\n", tmp);
+        return -1;
+    }
+    fputs(PROBE_CACHE_HEADER, out);
+    for (i = 0; i < pc->nb_files; i++) {
+        ProbeFile *file = &pc->files[i];
+        //failures are not cached, the file may be readable next time
+        if (file->json && !file->failed) {
+            probe_cache_write_entry(out, file->key ? file->key : file->path, file->size, file->mtime, file->json);
+        }
+    }
+    for (i = 0; i < pc->nb_cache; i++) {
+        if (!pc->cache[i].used) {
+            probe_cache_write_entry(out, pc->cache[i].path, pc->cache[i].size, pc->cache[i].mtime, pc->cache[i].json);
+        }
+    }
+    if (fclose(out) != 0 || rename(tmp, path) != 0) {
+        fprintf(stderr, "Could not write the probe cache %s\n", path);
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+static void probe_json_string(AVBPrint *bp, const char *str) {
+    const unsigned char *p;
+
+    av_bprint_chars(bp, '"', 1);
+    for (p = (const unsigned char *)str; p && *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            av_bprintf(bp, "\\%c", *p);
+        } else if (*p < 0x20) {
+            av_bprintf(bp, "\\u%04x", *p);
+        } else {
+            av_bprint_chars(bp, *p, 1);
+        }
+    }
+    av_bprint_chars(bp, '"', 1);
+}
+
+static void probe_json_streams(AVBPrint *bp, AVFormatContext *fmt_ctx) {
+    unsigned int i;
+
+    av_bprintf(bp, ",\"streams\":[");
+    for (i = 0; i < fmt_ctx->nb_streams; i++) {
+        AVStream *st = fmt_ctx->streams[i];
+        AVCodecParameters *par = st->codecpar;
+        const char *type = av_get_media_type_string(par->codec_type);
+
+        av_bprintf(bp, "%s{\"index\":%u,\"type\":", i ? "," : "", i);
+        probe_json_string(bp, type ? type : "unknown");
+        av_bprintf(bp, ",\"codec\":");
+        probe_json_string(bp, avcodec_get_name(par->codec_id));
+        if (par->bit_rate > 0) {
+            av_bprintf(bp, ",\"bit_rate\":%"PRId64, par->bit_rate);
+        }
+        if (st->duration != AV_NOPTS_VALUE) {
+            av_bprintf(bp, ",\"duration\":%.3f", st->duration * av_q2d(st->time_base));
+        }
+        if (par->codec_type == AVMEDIA_TYPE_VIDEO) {
+            const char *pix_fmt = av_get_pix_fmt_name(par->format);
+            av_bprintf(bp, ",\"width\":%d,\"height\":%d", par->width, par->height);
+            if (pix_fmt) {
+                av_bprintf(bp, ",\"pix_fmt\":");
+                probe_json_string(bp, pix_fmt);
+            }
+            if (st->avg_frame_rate.num > 0 && st->avg_frame_rate.den > 0) {
+                av_bprintf(bp, ",\"fps\":%.3f", av_q2d(st->avg_frame_rate));
+            }
+            if (st->disposition & AV_DISPOSITION_ATTACHED_PIC) {
+                av_bprintf(bp, ",\"cover_art\":true");
+            }
+        } else if (par->codec_type == AVMEDIA_TYPE_AUDIO) {
+            const char *sample_fmt = av_get_sample_fmt_name(par->format);
+            av_bprintf(bp, ",\"sample_rate\":%d,\"channels\":%d", par->sample_rate, par->channels);
+            if (sample_fmt) {
+                av_bprintf(bp, ",\"sample_fmt\":");
+                probe_json_string(bp, sample_fmt);
+            }
+        }
+        av_bprintf(bp, "}");
+    }
+    av_bprintf(bp, "]");
+}
+
+static void probe_file(ProbeFile *file) {
+    AVFormatContext *fmt_ctx = NULL;
+    AVBPrint bp;
+    int ret;
+
+    av_bprint_init(&bp, 0, AV_BPRINT_SIZE_UNLIMITED);
+    av_bprintf(&bp, "{\"path\":");
+    probe_json_string(&bp, file->path);
+    av_bprintf(&bp, ",\"size\":%"PRId64, file->size);
+
+    if ((ret = avformat_open_input(&fmt_ctx, file->path, NULL, NULL)) < 0 ||
+            (ret = avformat_find_stream_info(fmt_ctx, NULL)) < 0) {
+        char err[128];
+        av_strerror(ret, err, sizeof(err));
+        av_bprintf(&bp, ",\"error\":");
+        probe_json_string(&bp, err);
+        file->failed = 1;
+    } else {
+        av_bprintf(&bp, ",\"format\":");
+        probe_json_string(&bp, fmt_ctx->iformat->name);
+        if (fmt_ctx->duration != AV_NOPTS_VALUE) {
+            av_bprintf(&bp, ",\"duration\":%.3f", fmt_ctx->duration / (double)AV_TIME_BASE);
+        }
+        if (fmt_ctx->bit_rate > 0) {
+            av_bprintf(&bp, ",\"bit_rate\":%"PRId64, fmt_ctx->bit_rate);
+        }
+        probe_json_streams(&bp, fmt_ctx);
+    }
+    av_bprintf(&bp, "}");
+    if (fmt_ctx) {
+        avformat_close_input(&fmt_ctx);
+    }
+    av_bprint_finalize(&bp, &file->json);
+}
+
+static int probe_worker(void *userdata) {
+    ProbeContext *pc = (ProbeContext *)userdata;
+    int i;
+
+    while ((i = SDL_AtomicAdd(&pc->next_file, 1)) < pc->nb_files) {
+        ProbeFile *file = &pc->files[i];
+        ProbeEntry *entry;
+        struct stat st;
+
+        if (stat(file->path, &st) < 0) {
+            AVBPrint bp;
+            char err[128];
+            av_strerror(AVERROR(errno), err, sizeof(err));
+            av_bprint_init(&bp, 0, AV_BPRINT_SIZE_UNLIMITED);
+            av_bprintf(&bp, "{\"path\":");
+            probe_json_string(&bp, file->path);
+            av_bprintf(&bp, ",\"error\":");
+            probe_json_string(&bp, err);
+            av_bprintf(&bp, "}");
+            av_bprint_finalize(&bp, &file->json);
+            file->failed = 1;
+            continue;
+        }
+        file->size = st.st_size;
+        file->mtime = probe_mtime(&st);
+        //a.mp4, ./a.mp4 and a link to it are one entry
+        file->key = realpath(file->path, NULL);
+        entry = probe_cache_find(pc, file->key ? file->key : file->path);
+        if (entry && entry->size == file->size && entry->mtime == file->mtime) {
+            file->json = av_strdup(entry->json);
+            file->cached = 1;
+            continue;
+        }
+        probe_file(file);
+    }
+    return 0;
+}
+
+int probe_run(char **files, int nb_files, const ProbeOptions *opts) {
+    ProbeContext pc;
+    SDL_Thread **workers;
+    int nb_workers = opts->threads > 0 ? opts->threads : SDL_GetCPUCount();
+    int i, hits = 0, failed = 0, ret = 0;
+    int64_t start = av_gettime_relative();
+    double elapsed;
+
+    memset(&pc, 0, sizeof(pc));
+    pc.nb_files = nb_files;
+    pc.files = av_mallocz_array(nb_files, sizeof(ProbeFile));
+    nb_workers = FFMIN(nb_workers, nb_files);
+    workers = av_mallocz_array(nb_workers, sizeof(SDL_Thread *));
+    if (NULL == pc.files || NULL == workers) {
+        ret = AVERROR(ENOMEM);
+        goto done;
+    }
+    for (i = 0; i < nb_files; i++) {
+        pc.files[i].path = files[i];
+    }
+    //a thousand files print a thousand warnings otherwise
+    av_log_set_level(AV_LOG_ERROR);
+    if (opts->cache_path) {
+        probe_cache_load(&pc, opts->cache_path);
+    }
+
+    for (i = 0; i < nb_workers; i++) {
+        workers[i] = SDL_CreateThread(probe_worker, "probe_worker", &pc);
+    }
+    for (i = 0; i < nb_workers; i++) {
+        if (workers[i]) {
+            SDL_WaitThread(workers[i], NULL);
+        } else {
+            probe_worker(&pc);
+        }
+    }
+    elapsed = (av_gettime_relative() - start) / 1000000.0;
+
+    printf("[\n");
+    for (i = 0; i < nb_files; i++) {
+        ProbeFile *file = &pc.files[i];
+        ProbeEntry *entry = probe_cache_find(&pc, file->key ? file->key : file->path);
+        if (entry) {
+            entry->used = 1;
+        }
+        hits += file->cached;
+        failed += file->failed;
+        printf("%s%s\n", file->json ? file->json : "null", i + 1 < nb_files ? "," : "");
+    }
+    printf("]\n");
+    fflush(stdout);
+
+    if (opts->cache_path) {
+        probe_cache_save(&pc, opts->cache_path);
+    }
+    fprintf(stderr, "probe: %d files (%d from cache, %d failed) with %d workers in %.2fs: %.1f files/s\n",
+            nb_files, hits, failed, nb_workers, elapsed, elapsed > 0 ? nb_files / elapsed : 0);
+    if (failed) {
+        ret = -1;
+    }
+
+    done:
+        if (pc.files) {
+            for (i = 0; i < nb_files; i++) {
+                av_free(pc.files[i].json);
+                free(pc.files[i].key);
+            }
+        }
+        av_free(pc.files);
+        av_free(workers);
+        probe_cache_free(&pc);
+    return ret;
+}
@@ -0,0 +1,315 @@
+#include <stdio.h>
+#include <libavutil/time.h>
+#include "videoutils.h"
+#include "trace.h"
+
+/*
+ * Reverse playback.
+ *
+ * A decoder can only go forward from a keyframe, so playing backwards is done one
+ * segment at a time: seek to the keyframe before the segment end, decode up to the end
+ * into a GopBuffer, then queue the buffered frames to the picture queue last to first.
+ * Two buffers are used, while the feed thread presents one the decode thread already
+ * decodes the segment before it.
+ *
+ * A buffer holds at most REVERSE_GOP_MAX_FRAMES frames. For longer GOPs only the last
+ * frames before the end are kept and the next segment decodes the same GOP again up to
+ * the first kept frame.
+ */
+#define REVERSE_GOP_MAX_FRAMES 64
+#define REVERSE_GOP_MIN_FRAMES 8
+
+typedef struct GopBuffer {
+    AVFrame *frames[REVERSE_GOP_MAX_FRAMES]; //in pts order
+    int nb_frames;
+    int ready; //decoded, waiting for the feed thread
+}GopBuffer;
+
+typedef struct ReverseState {
+    GopBuffer gops[2];
+    int decode_done;
+    double start_pts; //presentation time the reverse playback starts from
+    SDL_mutex *mutex;
+    SDL_cond *cond;
+    SDL_Thread *decode_tid;
+    SDL_Thread *feed_tid;
+}ReverseState;
+
+static int reverse_running(VideoState *vs) {
+    return vs->reverse && !vs->quit;
+}
+
+static int reverse_interrupt_cb(void *opaque) {
+    return reverse_running((VideoState *)opaque) ? 0 : 1;
+}
+
+static void gop_buffer_clear(GopBuffer *gop) {
+    int i;
+    for (i = 0; i < gop->nb_frames; i++) {
+        mem_budget_sub(MEM_REVERSE, frame_buffer_size(gop->frames[i]));
+        av_frame_free(&(gop->frames[i]));
+    }
+    gop->nb_frames = 0;
+}
+
+/* takes the reference of frame, drops the oldest frame when the buffer is full. Over the
+ * memory budget the buffer shrinks down to REVERSE_GOP_MIN_FRAMES. */
+static int gop_buffer_push(GopBuffer *gop, AVFrame *frame) {
+    AVFrame *copy = av_frame_alloc();
+    if (NULL == copy) {
+        return -1;
+    }
+    av_frame_move_ref(copy, frame);
+    mem_budget_add(MEM_REVERSE, frame_buffer_size(copy));
+
+    if (gop->nb_frames == REVERSE_GOP_MAX_FRAMES ||
+            (gop->nb_frames >= REVERSE_GOP_MIN_FRAMES && mem_budget_exceeded())) {
+        mem_budget_sub(MEM_REVERSE, frame_buffer_size(gop->frames[0]));
+        av_frame_free(&(gop->frames[0]));
+        memmove(gop->frames, gop->frames + 1, (gop->nb_frames - 1) * sizeof(AVFrame *));
+        gop->nb_frames--;
+    }
+    gop->frames[gop->nb_frames++] = copy;
+    return 0;
+}
+
+/* Decode every frame with a pts before end, starting from the keyframe before it. */
+static int reverse_decode_segment(AVFormatContext *fmt_ctx, AVCodecContext *codecCtx, int stream_index,
+                                  int64_t end, GopBuffer *gop, AVFrame *frame) {
+    AVPacket packet;
+    int ret, done = 0;
+
+    if (av_seek_frame(fmt_ctx, stream_index, end - 1, AVSEEK_FLAG_BACKWARD) < 0) {
+        return 0;
+    }
+    avcodec_flush_buffers(codecCtx);
+
+    av_init_packet(&packet);
+    packet.data = NULL;
+    packet.size = 0;
+
+    while (!done) {
+        ret = av_read_frame(fmt_ctx, &packet);
+        if (ret == AVERROR_EXIT) {
+            return -1;
+        } else if (ret < 0) {
+            //end of file, drain the decoder
+            avcodec_send_packet(codecCtx, NULL);
+            done = 1;
+        } else if (packet.stream_index != stream_index) {
+            av_packet_unref(&packet);
+            continue;
+        } else {
+            ret = avcodec_send_packet(codecCtx, &packet);
+            av_packet_unref(&packet);
+            if (ret < 0) {
+                fprintf(stderr, "Error sending a packet for reverse decoding\n");
+                continue;
+            }
+        }
+
+        while (avcodec_receive_frame(codecCtx, frame) == 0) {
+            int64_t pts = frame->best_effort_timestamp;
+            if (pts == AV_NOPTS_VALUE) {
+                av_frame_unref(frame);
+            } else if (pts >= end) {
+                //frames leave the decoder in pts order, the segment is complete
+                av_frame_unref(frame);
+                done = 1;
+            } else if (gop_buffer_push(gop, frame) < 0) {
+                av_frame_unref(frame);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+static int reverse_decode_thread(void *userdata) {
+    VideoState *vs = (VideoState *)userdata;
+    ReverseState *rs = vs->rev;
+    AVFormatContext *fmt_ctx = NULL;
+    AVCodecContext *codecCtx = NULL;
+    AVFrame *frame = av_frame_alloc();
+    AVStream *st;
+    int stream_index = vs->videoStreamIndex;
+    int64_t end, start_time;
+    int slot = 0;
+    int ret;
+
+    trace_thread_name("reverse_decode");
+    //an own demuxer, so the forward one keeps its position and state
+    fmt_ctx = avformat_alloc_context();
+    if (NULL == fmt_ctx || NULL == frame) {
+        goto done;
+    }
+    fmt_ctx->interrupt_callback.callback = reverse_interrupt_cb;
+    fmt_ctx->interrupt_callback.opaque = vs;
+    if (avformat_open_input(&fmt_ctx, vs->filename, NULL, NULL) < 0) {
+        goto done;
+    }
+    if (avformat_find_stream_info(fmt_ctx, NULL) < 0) {
+        goto done;
+    }
+    if (open_codec_context(fmt_ctx, &stream_index, &codecCtx, AVMEDIA_TYPE_VIDEO) < 0) {
+        goto done;
+    }
+    st = fmt_ctx->streams[stream_index];
+    start_time = st->start_time != AV_NOPTS_VALUE ? st->start_time : 0;
+    end = (int64_t)(rs->start_pts / av_q2d(st->time_base));
+
+    while (reverse_running(vs) && end > start_time) {
+        GopBuffer *gop = &rs->gops[slot];
+
+        SDL_LockMutex(rs->mutex);
+        while (gop->ready && reverse_running(vs)) {
+            SDL_CondWait(rs->cond, rs->mutex);
+        }
+        SDL_UnlockMutex(rs->mutex);
+        if (!reverse_running(vs)) {
+            break;
+        }
+
+        trace_begin("reverse_segment");
+        ret = reverse_decode_segment(fmt_ctx, codecCtx, stream_index, end, gop, frame);
+        trace_end("reverse_segment");
+        if (ret < 0) {
+            break;
+        }
+        if (gop->nb_frames == 0) {
+            //nothing decodable before end, step back a second
+            end -= (int64_t)(1.0 / av_q2d(st->time_base));
+            continue;
+        }
+        end = gop->frames[0]->best_effort_timestamp;
+
+        SDL_LockMutex(rs->mutex);
+        gop->ready = 1;
+        SDL_CondBroadcast(rs->cond);
+        SDL_UnlockMutex(rs->mutex);
+        slot ^= 1;
+    }
+
+    done:
+        SDL_LockMutex(rs->mutex);
+        rs->decode_done = 1;
+        SDL_CondBroadcast(rs->cond);
+        SDL_UnlockMutex(rs->mutex);
+
+        av_frame_free(&frame);
+        avcodec_free_context(&codecCtx);
+        if (fmt_ctx) {
+            avformat_close_input(&fmt_ctx);
+        }
+    return 0;
+}
+
+static int reverse_feed_thread(void *userdata) {
+    VideoState *vs = (VideoState *)userdata;
+    ReverseState *rs = vs->rev;
+    double time_base = av_q2d(vs->video_stm->time_base);
+    int slot = 0;
+    int i;
+
+    trace_thread_name("reverse_feed");
+    for (;;) {
+        GopBuffer *gop = &rs->gops[slot];
+
+        SDL_LockMutex(rs->mutex);
+        while (!gop->ready && !rs->decode_done && reverse_running(vs)) {
+            SDL_CondWait(rs->cond, rs->mutex);
+        }
+        SDL_UnlockMutex(rs->mutex);
+        if (!gop->ready || !reverse_running(vs)) {
+            break;
+        }
+
+        for (i = gop->nb_frames - 1; i >= 0 && reverse_running(vs); i--) {
+            AVFrame *frame = gop->frames[i];
+            if (queue_picture(vs, frame, frame->best_effort_timestamp * time_base, 1) < 0) {
+                break;
+            }
+        }
+
+        SDL_LockMutex(rs->mutex);
+        gop_buffer_clear(gop);
+        gop->ready = 0;
+        SDL_CondBroadcast(rs->cond);
+        SDL_UnlockMutex(rs->mutex);
+        slot ^= 1;
+    }
+    return 0;
+}
+
+int reverse_start(VideoState *vs) {
+    ReverseState *rs = vs->rev;
+
+    if (NULL == vs->video_stm || vs->reverse) {
+        return -1;
+    }
+    if (NULL == rs) {
+        rs = av_mallocz(sizeof(ReverseState));
+        if (NULL == rs) {
+            return -1;
+        }
+        rs->mutex = SDL_CreateMutex();
+        rs->cond = SDL_CreateCond();
+        vs->rev = rs;
+    }
+    rs->decode_done = 0;
+    rs->start_pts = vs->frame_last_pts;
+
+    //under the picture queue lock, so a writer waiting for room sees the change
+    SDL_LockMutex(vs->pictq_mutex);
+    vs->reverse = 1;
+    SDL_CondBroadcast(vs->pictq_cond);
+    SDL_UnlockMutex(vs->pictq_mutex);
+
+    rs->decode_tid = SDL_CreateThread(reverse_decode_thread, "reverse_decode", vs);
+    rs->feed_tid = SDL_CreateThread(reverse_feed_thread, "reverse_feed", vs);
+    if (NULL == rs->decode_tid || NULL == rs->feed_tid) {
+        reverse_stop(vs);
+        return -1;
+    }
+    return 0;
+}
+
+void reverse_stop(VideoState *vs) {
+    ReverseState *rs = vs->rev;
+    int i;
+
+    if (!vs->reverse || NULL == rs) {
+        return;
+    }
+
+    SDL_LockMutex(vs->pictq_mutex);
+    vs->reverse = 0;
+    SDL_CondBroadcast(vs->pictq_cond);
+    SDL_UnlockMutex(vs->pictq_mutex);
+
+    SDL_LockMutex(rs->mutex);
+    SDL_CondBroadcast(rs->cond);
+    SDL_UnlockMutex(rs->mutex);
+
+    if (rs->decode_tid) {
+        SDL_WaitThread(rs->decode_tid, NULL);
+        rs->decode_tid = NULL;
+    }
+    if (rs->feed_tid) {
+        SDL_WaitThread(rs->feed_tid, NULL);
+        rs->feed_tid = NULL;
+    }
+    for (i = 0; i < 2; i++) {
+        gop_buffer_clear(&rs->gops[i]);
+        rs->gops[i].ready = 0;
+    }
+
+    //continue forward from the picture on screen
+    stream_seek(vs, (int64_t)(vs->frame_last_pts * AV_TIME_BASE), -1);
+    vs->frame_timer = (double)av_gettime_relative() / 1000000.0;
+
+    //the forward demuxer parks on pause_cond while reversing
+    SDL_LockMutex(vs->pause_mutex);
+    SDL_CondBroadcast(vs->pause_cond);
+    SDL_UnlockMutex(vs->pause_mutex);
+}
@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <libavutil/time.h>
+#include "videoutils.h"
+#include "stats.h"
+
+#define STATS_INTERVAL 200000 //microseconds between updates
+
+typedef struct StatsExport {
+    PlayerStats *shared;
+    char name[256];
+    int64_t last_update;
+    int64_t last_decoded;
+    int64_t updates;
+    uint32_t wakeup_event;
+    SDL_TimerID timer;
+}StatsExport;
+
+static StatsExport stats;
+
+int stats_open(const char *name) {
+    int fd;
+
+    if (name) {
+        snprintf(stats.name, sizeof(stats.name), "%s%s", name[0] == '/' ? "" : "/", name);
+    } else {
+        snprintf(stats.name, sizeof(stats.name), PLAYER_STATS_PREFIX "%d", (int)getpid());
+    }
+    fd = shm_open(stats.name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Could not create the stats block %s\n", stats.name);
+        return -1;
+    }
+    if (ftruncate(fd, sizeof(PlayerStats)) < 0) {
+        close(fd);
+        shm_unlink(stats.name);
+        return -1;
+    }
+    stats.shared = mmap(NULL, sizeof(PlayerStats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == stats.shared) {
+        stats.shared = NULL;
+        shm_unlink(stats.name);
+        return -1;
+    }
+
+    stats.shared->version = PLAYER_STATS_VERSION;
+    stats.shared->size = sizeof(PlayerStats);
+    stats.shared->pid = getpid();
+    //magic last, a reader seeing it finds the header complete
+    __atomic_store_n(&stats.shared->magic, PLAYER_STATS_MAGIC, __ATOMIC_RELEASE);
+    fprintf(stderr, "stats published in shared memory %s\n", stats.name);
+    return 0;
+}
+
+static double queue_duration(PacketQueue *q, AVStream *st) {
+    return st ? q->duration * av_q2d(st->time_base) : 0;
+}
+
+static Uint32 stats_timer(Uint32 interval, void *opaque) {
+    SDL_Event event;
+    SDL_zero(event);
+    event.type = stats.wakeup_event;
+    SDL_PushEvent(&event);
+    return interval;
+}
+
+int stats_start_timer(uint32_t event_type) {
+    if (NULL == stats.shared || stats.timer) {
+        return 0;
+    }
+    if (SDL_InitSubSystem(SDL_INIT_TIMER) < 0) {
+        return -1;
+    }
+    stats.wakeup_event = event_type;
+    stats.timer = SDL_AddTimer(STATS_INTERVAL / 1000, stats_timer, NULL);
+    return stats.timer ? 0 : -1;
+}
+
+/* Called from the event loop. The values are read without the locks of their owners,
+ * a counter may be one update behind but the block itself is always consistent. */
+void stats_publish(VideoState *vs) {
+    PlayerStats update;
+    PlayerStats *shared = stats.shared;
+    int64_t now = av_gettime_relative();
+    uint32_t seq;
+
+    //the timer may fire a little early
+    if (NULL == shared || now - stats.last_update < STATS_INTERVAL * 9 / 10) {
+        return;
+    }
+
+    memset(&update, 0, sizeof(PlayerStats));
+    update.pid = shared->pid;
+    update.updates = ++stats.updates;
+    update.update_time = now;
+    update.paused = vs->paused;
+    update.reverse = vs->reverse;
+    update.pictq_size = vs->pictq_size;
+    update.pictq_depth = vs->pictq_depth;
+    update.audioq_packets = vs->audioq.nb_packets;
+    update.videoq_packets = vs->videoq.nb_packets;
+    update.audioq_bytes = vs->audioq.size;
+    update.videoq_bytes = vs->videoq.size;
+    update.audioq_duration = queue_duration(&vs->audioq, vs->audio_stm);
+    update.videoq_duration = queue_duration(&vs->videoq, vs->video_stm);
+    update.frames_decoded = vs->frames_decoded;
+    update.frames_displayed = vs->frames_displayed;
+    update.frames_dropped = vs->live_video_dropped;
+    if (stats.last_update) {
+        update.decode_fps = (vs->frames_decoded - stats.last_decoded) * 1000000.0 / (now - stats.last_update);
+    }
+    update.audio_underruns = vs->audio_underruns;
+    update.audio_packets_dropped = vs->live_audio_dropped;
+    update.av_drift = vs->av_drift;
+    update.audio_clock = vs->audio_stm ? get_audio_clock(vs) : 0;
+    update.video_clock = vs->frame_last_pts;
+    update.buffered_bytes = mem_budget_total();
+    stats.last_update = now;
+    stats.last_decoded = vs->frames_decoded;
+
+    //sequence lock, odd while the block is being written. The header up to pid never changes
+    seq = shared->seq;
+    __atomic_store_n(&shared->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy((uint8_t *)shared + offsetof(PlayerStats, pid), (uint8_t *)&update + offsetof(PlayerStats, pid),
+           sizeof(PlayerStats) - offsetof(PlayerStats, pid));
+    __atomic_store_n(&shared->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void stats_close(void) {
+    if (stats.timer) {
+        SDL_RemoveTimer(stats.timer);
+        stats.timer = 0;
+    }
+    if (NULL == stats.shared) {
+        return;
+    }
+    munmap(stats.shared, sizeof(PlayerStats));
+    shm_unlink(stats.name);
+    stats.shared = NULL;
+}
@@ -0,0 +1,40 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+/* Layout of the shared memory block a player publishes its statistics in, with -stats.
+ *
+ * The player is the only writer and updates the block a few times per second under a
+ * sequence lock: seq is odd while an update is in progress. A reader copies the block and
+ * retries when seq was odd or changed during the copy, it never blocks the player.
+ *
+ * Fields are only ever appended; a reader checks magic, then uses version and size to
+ * know which fields exist. Durations and clocks are in seconds. */
+#define PLAYER_STATS_MAGIC 0x54415453 //"STAT"
+#define PLAYER_STATS_VERSION 1
+#define PLAYER_STATS_PREFIX "/tutorial-sdl2-player."
+
+typedef struct PlayerStats {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;          //sizeof(PlayerStats) of the writer
+    uint32_t seq;
+    int32_t pid;
+    int32_t paused, reverse;
+    int32_t pictq_size, pictq_depth;
+    int32_t audioq_packets, videoq_packets;
+    int32_t reserved;
+    int64_t updates;
+    int64_t update_time;    //microseconds, monotonic clock of the player
+    int64_t audioq_bytes, videoq_bytes;
+    double audioq_duration, videoq_duration;
+    int64_t frames_decoded, frames_displayed, frames_dropped;
+    double decode_fps;      //over the last update interval
+    int64_t audio_underruns, audio_packets_dropped;
+    double av_drift;        //video pts - audio clock at the last displayed picture
+    double audio_clock, video_clock;
+    int64_t buffered_bytes; //everything the memory accounting knows of
+}PlayerStats;
+
+#endif
@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "stats.h"
+
+/*
+ * player-stats: print the statistics a running player publishes with -stats.
+ *
+ * Reads the shared memory block without ever blocking the player, see stats.h.
+ */
+
+//0 when the block is not there or of another kind
+static int stats_read(const PlayerStats *shared, size_t map_size, PlayerStats *copy) {
+    uint32_t seq1, seq2;
+    size_t size;
+
+    if (map_size < sizeof(uint32_t) * 4 || __atomic_load_n(&shared->magic, __ATOMIC_ACQUIRE) != PLAYER_STATS_MAGIC) {
+        return 0;
+    }
+    //a newer player may have appended fields, an older one may lack some
+    size = shared->size < map_size ? shared->size : map_size;
+    memset(copy, 0, sizeof(PlayerStats));
+    do {
+        seq1 = __atomic_load_n(&shared->seq, __ATOMIC_ACQUIRE);
+        memcpy(copy, shared, size);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        seq2 = __atomic_load_n(&shared->seq, __ATOMIC_RELAXED);
+    } while ((seq1 & 1) || seq1 != seq2);
+    return 1;
+}
+
+static void stats_print(const PlayerStats *s) {
+    printf("pid=%d updates=%"PRId64" paused=%d reverse=%d "
+           "videoq=%d/%"PRId64"B/%.3fs audioq=%d/%"PRId64"B/%.3fs pictq=%d/%d "
+           "decoded=%"PRId64" displayed=%"PRId64" dropped=%"PRId64" fps=%.2f "
+           "underruns=%"PRId64" audio_dropped=%"PRId64" drift=%.3f "
+           "audio_clock=%.3f video_clock=%.3f buffered=%"PRId64"\n",
+           s->pid, s->updates, s->paused, s->reverse,
+           s->videoq_packets, s->videoq_bytes, s->videoq_duration,
+           s->audioq_packets, s->audioq_bytes, s->audioq_duration,
+           s->pictq_size, s->pictq_depth,
+           s->frames_decoded, s->frames_displayed, s->frames_dropped, s->decode_fps,
+           s->audio_underruns, s->audio_packets_dropped, s->av_drift,
+           s->audio_clock, s->video_clock, s->buffered_bytes);
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+    char name[256];
+    PlayerStats *shared, copy;
+    struct stat st;
+    size_t map_size;
+    int interval = 0;
+    int fd;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage:./player-stats pid|shm_name [interval_ms]\n");
+        return 2;
+    }
+    if (isdigit((unsigned char)argv[1][0])) {
+        snprintf(name, sizeof(name), PLAYER_STATS_PREFIX "%s", argv[1]);
+    } else {
+        snprintf(name, sizeof(name), "%s%s", argv[1][0] == '/' ? "" : "/", argv[1]);
+    }
+    if (argc > 2) {
+        interval = atoi(argv[2]);
+    }
+
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        fprintf(stderr, "No stats block %s\n", name);
+        return 1;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        return 1;
+    }
+    map_size = (size_t)st.st_size < sizeof(PlayerStats) ? (size_t)st.st_size : sizeof(PlayerStats);
+    shared = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == shared) {
+        return 1;
+    }
+
+    do {
+        if (!stats_read(shared, map_size, &copy)) {
+            fprintf(stderr, "%s is not a player stats block\n", name);
+            munmap(shared, map_size);
+            return 1;
+        }
+        stats_print(&copy);
+        if (interval > 0) {
+            usleep(interval * 1000);
+        }
+    } while (interval > 0);
+
+    munmap(shared, map_size);
+    return 0;
+}
@@ -0,0 +1,342 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <SDL2/SDL.h>
+#include <libavutil/common.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+#include "taskpool.h"
+#include "threadsched.h"
+#include "trace.h"
+
+#define TASK_LOCALITY_SLACK 2000 //microseconds, an own task this close to the earliest one goes first
+#define TASK_IDLE_WAIT 10 //milliseconds a worker sleeps at most, a safety net for lost wakeups
+
+typedef struct Task {
+    TaskFunc fn;
+    void *arg;
+    int64_t deadline;
+    int64_t ready_time;
+}Task;
+
+//binary min heap, by deadline or by ready time
+typedef struct TaskHeap {
+    Task *tasks;
+    int nb_tasks, nb_alloc;
+}TaskHeap;
+
+typedef struct TaskWorker {
+    TaskPool *pool;
+    SDL_Thread *tid;
+    SDL_SpinLock lock;
+    TaskHeap ready;
+    volatile int64_t ready_min; //deadline on top of the heap, read unlocked by thieves
+    //owned by the worker thread
+    int64_t tasks_run, tasks_stolen;
+    int64_t late_sum, late_max;
+}TaskWorker;
+
+struct TaskPool {
+    TaskWorker *workers;
+    int nb_workers;
+    SDL_mutex *mutex; //the timers and the sleeping workers
+    SDL_cond *cond;
+    TaskHeap timers;
+    volatile int64_t next_timer;
+    SDL_atomic_t pending; //ready tasks in all heaps
+    SDL_atomic_t sleeping;
+    SDL_atomic_t next_worker; //round robin for tasks from outside the pool
+    volatile int quit;
+};
+
+static __thread TaskWorker *current_worker;
+
+static int64_t task_key(const Task *task, int by_ready) {
+    return by_ready ? task->ready_time : task->deadline;
+}
+
+static int task_heap_push(TaskHeap *heap, const Task *task, int by_ready) {
+    int i;
+
+    if (heap->nb_tasks == heap->nb_alloc) {
+        int nb_alloc = heap->nb_alloc ? heap->nb_alloc * 2 : 64;
+        Task *tasks = av_realloc_array(heap->tasks, nb_alloc, sizeof(Task));
+        if (NULL == tasks) {
+            return AVERROR(ENOMEM);
+        }
+        heap->tasks = tasks;
+        heap->nb_alloc = nb_alloc;
+    }
+    i = heap->nb_tasks++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (task_key(&heap->tasks[parent], by_ready) <= task_key(task, by_ready)) {
+            break;
+        }
+        heap->tasks[i] = heap->tasks[parent];
+        i = parent;
+    }
+    heap->tasks[i] = *task;
+    return 0;
+}
+
+static void task_heap_pop(TaskHeap *heap, Task *task, int by_ready) {
+    Task last;
+    int i = 0;
+
+    *task = heap->tasks[0];
+    last = heap->tasks[--heap->nb_tasks];
+    if (0 == heap->nb_tasks) {
+        return;
+    }
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= heap->nb_tasks) {
+            break;
+        }
+        if (child + 1 < heap->nb_tasks &&
+                task_key(&heap->tasks[child + 1], by_ready) < task_key(&heap->tasks[child], by_ready)) {
+            child++;
+        }
+        if (task_key(&last, by_ready) <= task_key(&heap->tasks[child], by_ready)) {
+            break;
+        }
+        heap->tasks[i] = heap->tasks[child];
+        i = child;
+    }
+    heap->tasks[i] = last;
+}
+
+static int task_worker_push(TaskWorker *w, const Task *task) {
+    int ret;
+
+    SDL_AtomicLock(&w->lock);
+    ret = task_heap_push(&w->ready, task, 0);
+    w->ready_min = w->ready.nb_tasks ? w->ready.tasks[0].deadline : INT64_MAX;
+    SDL_AtomicUnlock(&w->lock);
+    if (ret >= 0) {
+        SDL_AtomicIncRef(&w->pool->pending);
+    }
+    return ret;
+}
+
+static int task_worker_pop(TaskWorker *w, Task *task) {
+    int found = 0;
+
+    SDL_AtomicLock(&w->lock);
+    if (w->ready.nb_tasks > 0) {
+        task_heap_pop(&w->ready, task, 0);
+        found = 1;
+    }
+    w->ready_min = w->ready.nb_tasks ? w->ready.tasks[0].deadline : INT64_MAX;
+    SDL_AtomicUnlock(&w->lock);
+    if (found) {
+        SDL_AtomicDecRef(&w->pool->pending);
+    }
+    return found;
+}
+
+static void task_pool_wake(TaskPool *pool) {
+    if (SDL_AtomicGet(&pool->sleeping) > 0) {
+        SDL_LockMutex(pool->mutex);
+        SDL_CondSignal(pool->cond);
+        SDL_UnlockMutex(pool->mutex);
+    }
+}
+
+//timers whose time has come move to the heap of the worker that noticed
+static void task_pool_expire(TaskPool *pool, TaskWorker *w, int64_t now) {
+    Task task;
+
+    if (now < pool->next_timer) {
+        return;
+    }
+    SDL_LockMutex(pool->mutex);
+    while (pool->timers.nb_tasks > 0 && pool->timers.tasks[0].ready_time <= now) {
+        task_heap_pop(&pool->timers, &task, 1);
+        task_worker_push(w, &task);
+    }
+    pool->next_timer = pool->timers.nb_tasks ? pool->timers.tasks[0].ready_time : INT64_MAX;
+    SDL_UnlockMutex(pool->mutex);
+}
+
+/* The earliest deadline of the pool, from the own heap unless another worker holds a task
+ * clearly more urgent. The heap tops are read unlocked, a stale one costs a retry. */
+static int task_pool_take(TaskPool *pool, TaskWorker *w, Task *task) {
+    TaskWorker *victim = NULL;
+    int64_t own = w->ready_min, best = INT64_MAX;
+    int i;
+
+    for (i = 0; i < pool->nb_workers; i++) {
+        TaskWorker *other = &pool->workers[i];
+        if (other != w && other->ready_min < best) {
+            best = other->ready_min;
+            victim = other;
+        }
+    }
+    if (own != INT64_MAX && (NULL == victim || own <= best + TASK_LOCALITY_SLACK) && task_worker_pop(w, task)) {
+        return 1;
+    }
+    if (victim && task_worker_pop(victim, task)) {
+        w->tasks_stolen++;
+        return 1;
+    }
+    return task_worker_pop(w, task);
+}
+
+static int task_worker_thread(void *userdata) {
+    TaskWorker *w = (TaskWorker *)userdata;
+    TaskPool *pool = w->pool;
+    Task task;
+    int64_t now, wait;
+
+    current_worker = w;
+    thread_sched_enter(THREAD_VIDEO);
+    trace_thread_name("task_worker");
+    while (!pool->quit) {
+        now = av_gettime_relative();
+        task_pool_expire(pool, w, now);
+        if (task_pool_take(pool, w, &task)) {
+            if (now > task.deadline) {
+                w->late_sum += now - task.deadline;
+                w->late_max = FFMAX(w->late_max, now - task.deadline);
+            }
+            w->tasks_run++;
+            task.fn(task.arg);
+            continue;
+        }
+
+        //sleeping is raised before pending is checked, a submitter sees one or the other
+        SDL_LockMutex(pool->mutex);
+        SDL_AtomicIncRef(&pool->sleeping);
+        if (SDL_AtomicGet(&pool->pending) == 0 && !pool->quit) {
+            wait = TASK_IDLE_WAIT * 1000;
+            if (pool->timers.nb_tasks > 0) {
+                wait = FFMIN(wait, pool->timers.tasks[0].ready_time - av_gettime_relative());
+            }
+            if (wait > 0) {
+                trace_begin("pool_idle");
+                SDL_CondWaitTimeout(pool->cond, pool->mutex, (Uint32)((wait + 999) / 1000));
+                trace_end("pool_idle");
+            }
+        }
+        SDL_AtomicDecRef(&pool->sleeping);
+        SDL_UnlockMutex(pool->mutex);
+    }
+    return 0;
+}
+
+TaskPool *task_pool_create(int nb_workers) {
+    TaskPool *pool = av_mallocz(sizeof(TaskPool));
+    int i;
+
+    if (NULL == pool) {
+        return NULL;
+    }
+    pool->nb_workers = nb_workers > 0 ? nb_workers : SDL_GetCPUCount();
+    pool->workers = av_mallocz_array(pool->nb_workers, sizeof(TaskWorker));
+    pool->mutex = SDL_CreateMutex();
+    pool->cond = SDL_CreateCond();
+    pool->next_timer = INT64_MAX;
+    if (NULL == pool->workers || NULL == pool->mutex || NULL == pool->cond) {
+        task_pool_destroy(&pool);
+        return NULL;
+    }
+    for (i = 0; i < pool->nb_workers; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].ready_min = INT64_MAX;
+    }
+    for (i = 0; i < pool->nb_workers; i++) {
+        pool->workers[i].tid = SDL_CreateThread(task_worker_thread, "task_worker", &pool->workers[i]);
+        if (NULL == pool->workers[i].tid) {
+            fprintf(stderr, "Could not start task worker %d\n", i);
+            task_pool_destroy(&pool);
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+int task_pool_submit(TaskPool *pool, TaskFunc fn, void *arg, int64_t deadline, int64_t ready_time) {
+    Task task;
+    TaskWorker *w;
+    int ret;
+
+    task.fn = fn;
+    task.arg = arg;
+    task.deadline = deadline;
+    task.ready_time = ready_time;
+    if (ready_time > av_gettime_relative()) {
+        SDL_LockMutex(pool->mutex);
+        ret = task_heap_push(&pool->timers, &task, 1);
+        pool->next_timer = pool->timers.nb_tasks ? pool->timers.tasks[0].ready_time : INT64_MAX;
+        //a sleeping worker may have to wake up earlier now
+        SDL_CondSignal(pool->cond);
+        SDL_UnlockMutex(pool->mutex);
+        return ret;
+    }
+
+    //a worker keeps what it submits, the cache is warm for it; others steal when idle
+    if (current_worker && current_worker->pool == pool) {
+        w = current_worker;
+    } else {
+        w = &pool->workers[(unsigned int)SDL_AtomicAdd(&pool->next_worker, 1) % pool->nb_workers];
+    }
+    ret = task_worker_push(w, &task);
+    if (ret >= 0) {
+        task_pool_wake(pool);
+    }
+    return ret;
+}
+
+int task_pool_workers(TaskPool *pool) {
+    return pool->nb_workers;
+}
+
+void task_pool_report(TaskPool *pool, FILE *out) {
+    int64_t run = 0, stolen = 0, late_sum = 0, late_max = 0;
+    int i;
+
+    for (i = 0; i < pool->nb_workers; i++) {
+        TaskWorker *w = &pool->workers[i];
+        run += w->tasks_run;
+        stolen += w->tasks_stolen;
+        late_sum += w->late_sum;
+        late_max = FFMAX(late_max, w->late_max);
+    }
+    fprintf(out, "task pool: %d workers, %"PRId64" tasks, %"PRId64" stolen, past deadline %.2f ms avg %.2f ms max\n",
+            pool->nb_workers, run, stolen, run ? late_sum / 1000.0 / run : 0, late_max / 1000.0);
+}
+
+void task_pool_destroy(TaskPool **ppool) {
+    TaskPool *pool = *ppool;
+    int i;
+
+    if (NULL == pool) {
+        return;
+    }
+    pool->quit = 1;
+    if (pool->mutex) {
+        SDL_LockMutex(pool->mutex);
+        SDL_CondBroadcast(pool->cond);
+        SDL_UnlockMutex(pool->mutex);
+    }
+    if (pool->workers) {
+        for (i = 0; i < pool->nb_workers; i++) {
+            if (pool->workers[i].tid) {
+                SDL_WaitThread(pool->workers[i].tid, NULL);
+            }
+            av_free(pool->workers[i].ready.tasks);
+        }
+    }
+    av_free(pool->timers.tasks);
+    av_free(pool->workers);
+    if (pool->cond) {
+        SDL_DestroyCond(pool->cond);
+    }
+    if (pool->mutex) {
+        SDL_DestroyMutex(pool->mutex);
+    }
+    av_freep(ppool);
+}
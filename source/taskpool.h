@@ -0,0 +1,33 @@
+#ifndef TASKPOOL_H
+#define TASKPOOL_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* A pool of worker threads, one per cpu, that runs short tasks of many pipelines instead
+ * of a set of mostly idle threads per pipeline.
+ *
+ * A task has a deadline and may have a ready time before which it does not run. Every
+ * worker keeps its ready tasks in a heap by deadline and runs the earliest one, unless
+ * another worker holds an earlier one: then it steals that. So the most overdue task of the
+ * whole pool runs first, and an idle worker takes work from busy ones. Tasks a worker
+ * submits stay with it while nobody else needs them. Times are av_gettime_relative()
+ * microseconds. A task must not block, it submits its continuation instead. */
+typedef void (*TaskFunc)(void *arg);
+
+typedef struct TaskPool TaskPool;
+
+//0 workers for one per cpu
+TaskPool *task_pool_create(int nb_workers);
+
+//fn(arg) runs once the time is past ready_time, 0 for at once
+int task_pool_submit(TaskPool *pool, TaskFunc fn, void *arg, int64_t deadline, int64_t ready_time);
+
+int task_pool_workers(TaskPool *pool);
+
+void task_pool_report(TaskPool *pool, FILE *out);
+
+//stops the workers after their current task, tasks not run yet are dropped
+void task_pool_destroy(TaskPool **pool);
+
+#endif
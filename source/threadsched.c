@@ -0,0 +1,417 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <SDL2/SDL.h>
+#include <libavutil/avstring.h>
+#ifdef __linux__
+#include <sched.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <pthread.h>
+#endif
+#include "threadsched.h"
+
+#define THREAD_SCHED_MAX_CPUS 1024
+//wakeup latency probe: sleeps of THREAD_PROBE_SLEEP_US, the overshoot is the latency
+#define THREAD_PROBE_ROUNDS 50
+#define THREAD_PROBE_SLEEP_US 1000
+
+typedef struct ThreadConfig {
+    int set;
+    uint8_t cpus[THREAD_SCHED_MAX_CPUS / 8];
+    int has_cpus;
+    int fifo;   //SCHED_FIFO priority, 0 keeps the default policy
+    int nice, has_nice;
+    char name[16];
+}ThreadConfig;
+
+typedef struct ThreadLatency {
+    int measured;
+    double before_avg, before_max, after_avg, after_max; //microseconds
+}ThreadLatency;
+
+#define SETTING_CPUS 1
+#define SETTING_NICE 2
+#define SETTING_FIFO 4
+#define SETTING_NAME 8
+
+typedef struct ThreadSched {
+    ThreadConfig configs[THREAD_ROLE_NB];
+    ThreadLatency latency[THREAD_ROLE_NB];
+    int threads[THREAD_ROLE_NB]; //threads configured per role
+    int failed[THREAD_ROLE_NB];  //SETTING_ flags refused at least once
+    int probe;
+    SDL_Thread *probes[THREAD_ROLE_NB];
+    SDL_SpinLock lock;
+}ThreadSched;
+
+static ThreadSched sched_state;
+#ifdef __linux__
+//held from a snapshot to its adopt, two decoders opening at once would take each other's threads
+static pthread_mutex_t adopt_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+static __thread unsigned int entered_roles;
+
+static const char *role_names[THREAD_ROLE_NB] = {
+    "demux",
+    "video",
+    "audio",
+    "present",
+    "timer",
+    "decoder",
+    "waveform",
+};
+
+static int parse_cpus(ThreadConfig *cfg, const char *list) {
+    char *end;
+    while (*list) {
+        long first = strtol(list, &end, 10), last;
+        if (end == list || first < 0 || first >= THREAD_SCHED_MAX_CPUS) {
+            return -1;
+        }
+        last = first;
+        if (*end == '-') {
+            list = end + 1;
+            last = strtol(list, &end, 10);
+            if (end == list || last < first || last >= THREAD_SCHED_MAX_CPUS) {
+                return -1;
+            }
+        }
+        for (; first <= last; first++) {
+            cfg->cpus[first / 8] |= 1 << (first % 8);
+        }
+        if (*end == ',') {
+            end++;
+        } else if (*end != '\0') {
+            return -1;
+        }
+        list = end;
+    }
+    cfg->has_cpus = 1;
+    return 0;
+}
+
+int thread_sched_parse(const char *spec) {
+    char buf[256];
+    char *token, *saveptr = NULL;
+    ThreadConfig *cfg = NULL;
+    int i;
+
+    av_strlcpy(buf, spec, sizeof(buf));
+    token = strtok_r(buf, ":", &saveptr);
+    for (i = 0; token && i < THREAD_ROLE_NB; i++) {
+        if (!strcmp(token, role_names[i])) {
+            cfg = &sched_state.configs[i];
+        }
+    }
+    if (NULL == cfg) {
+        fprintf(stderr, "unknown thread role in %s, one of demux, video, audio, present, timer, decoder, waveform\n", spec);
+        return -1;
+    }
+
+    while ((token = strtok_r(NULL, ":", &saveptr))) {
+        char *value = strchr(token, '=');
+        if (NULL == value) {
+            goto fail;
+        }
+        *value++ = '\0';
+        if (!strcmp(token, "cpus")) {
+            if (parse_cpus(cfg, value) < 0) {
+                goto fail;
+            }
+        } else if (!strcmp(token, "fifo")) {
+            cfg->fifo = atoi(value);
+            if (cfg->fifo < 1 || cfg->fifo > 99) {
+                goto fail;
+            }
+        } else if (!strcmp(token, "nice")) {
+            cfg->nice = atoi(value);
+            cfg->has_nice = 1;
+        } else if (!strcmp(token, "name")) {
+            av_strlcpy(cfg->name, value, sizeof(cfg->name));
+        } else {
+            goto fail;
+        }
+    }
+    cfg->set = 1;
+    return 0;
+
+    fail:
+        fprintf(stderr, "bad thread setting in %s\n", spec);
+        return -1;
+}
+
+void thread_sched_set_probe(int enable) {
+    sched_state.probe = enable;
+}
+
+static void probe_latency(double *avg, double *max) {
+    struct timespec req = { 0, THREAD_PROBE_SLEEP_US * 1000 };
+    struct timespec t0, t1;
+    double sum = 0;
+    int i;
+
+    *max = 0;
+    for (i = 0; i < THREAD_PROBE_ROUNDS; i++) {
+        double late;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        nanosleep(&req, NULL);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        late = (t1.tv_sec - t0.tv_sec) * 1e6 + (t1.tv_nsec - t0.tv_nsec) / 1e3 - THREAD_PROBE_SLEEP_US;
+        sum += late;
+        if (late > *max) {
+            *max = late;
+        }
+    }
+    *avg = sum / THREAD_PROBE_ROUNDS;
+}
+
+//report a refused setting once per role
+static void setting_failed(ThreadRole role, int setting, const char *what, int err) {
+    int first;
+    SDL_AtomicLock(&sched_state.lock);
+    first = !(sched_state.failed[role] & setting);
+    sched_state.failed[role] |= setting;
+    SDL_AtomicUnlock(&sched_state.lock);
+    if (first) {
+        fprintf(stderr, "%s thread: %s refused (%s), continuing without it\n",
+                role_names[role], what, strerror(err));
+    }
+}
+
+#ifdef __linux__
+static int current_tid(void) {
+    return (int)syscall(SYS_gettid);
+}
+
+static void tune_thread(int tid, ThreadRole role) {
+    ThreadConfig *cfg = &sched_state.configs[role];
+
+    if (cfg->has_cpus) {
+        cpu_set_t set;
+        int cpu;
+        CPU_ZERO(&set);
+        for (cpu = 0; cpu < THREAD_SCHED_MAX_CPUS && cpu < CPU_SETSIZE; cpu++) {
+            if (cfg->cpus[cpu / 8] & (1 << (cpu % 8))) {
+                CPU_SET(cpu, &set);
+            }
+        }
+        if (sched_setaffinity(tid, sizeof(set), &set) < 0) {
+            setting_failed(role, SETTING_CPUS, "cpu affinity", errno);
+        }
+    }
+    if (cfg->has_nice && setpriority(PRIO_PROCESS, tid, cfg->nice) < 0) {
+        setting_failed(role, SETTING_NICE, "nice level", errno);
+    }
+    if (cfg->fifo) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = cfg->fifo;
+        if (sched_setscheduler(tid, SCHED_FIFO, &param) < 0) {
+            setting_failed(role, SETTING_FIFO, "SCHED_FIFO", errno);
+        }
+    }
+}
+
+static void apply_settings(int tid, ThreadRole role, const char *name) {
+    char path[64];
+    FILE *comm;
+
+    if (name && name[0]) {
+        snprintf(path, sizeof(path), "/proc/self/task/%d/comm", tid);
+        comm = fopen(path, "w");
+        if (NULL == comm || fputs(name, comm) < 0) {
+            setting_failed(role, SETTING_NAME, "name", errno);
+        }
+        if (comm) {
+            fclose(comm);
+        }
+    }
+    if (!sched_state.configs[role].set) {
+        return;
+    }
+    tune_thread(tid, role);
+
+    SDL_AtomicLock(&sched_state.lock);
+    sched_state.threads[role]++;
+    SDL_AtomicUnlock(&sched_state.lock);
+}
+
+static int read_comm(int tid, char *comm, int size) {
+    char path[64];
+    FILE *in;
+    int len;
+
+    snprintf(path, sizeof(path), "/proc/self/task/%d/comm", tid);
+    in = fopen(path, "r");
+    if (NULL == in) {
+        return -1;
+    }
+    if (NULL == fgets(comm, size, in)) {
+        fclose(in);
+        return -1;
+    }
+    fclose(in);
+    len = strlen(comm);
+    if (len > 0 && comm[len - 1] == '\n') {
+        comm[len - 1] = '\0';
+    }
+    return 0;
+}
+
+static void list_tids(ThreadSnapshot *snap) {
+    DIR *dir = opendir("/proc/self/task");
+    struct dirent *entry;
+
+    snap->nb_tids = 0;
+    if (NULL == dir) {
+        return;
+    }
+    while ((entry = readdir(dir)) && snap->nb_tids < THREAD_SNAPSHOT_MAX) {
+        if (entry->d_name[0] != '.') {
+            snap->tids[snap->nb_tids++] = atoi(entry->d_name);
+        }
+    }
+    closedir(dir);
+}
+
+void thread_sched_snapshot(ThreadSnapshot *snap) {
+    pthread_mutex_lock(&adopt_lock);
+    if (read_comm(current_tid(), snap->comm, sizeof(snap->comm)) < 0) {
+        snap->comm[0] = '\0';
+    }
+    list_tids(snap);
+}
+
+void thread_sched_adopt(ThreadRole role, const ThreadSnapshot *before, const char *prefix) {
+    ThreadConfig *cfg = &sched_state.configs[role];
+    ThreadSnapshot after;
+    char name[16], comm[16];
+    int i, j, n = 0;
+
+    if (!before->comm[0]) {
+        //without the name nothing tells our threads from those another thread started meanwhile
+        pthread_mutex_unlock(&adopt_lock);
+        return;
+    }
+    list_tids(&after);
+    for (i = 0; i < after.nb_tids; i++) {
+        for (j = 0; j < before->nb_tids; j++) {
+            if (after.tids[i] == before->tids[j]) {
+                break;
+            }
+        }
+        if (j < before->nb_tids) {
+            continue;
+        }
+        //threads inherit the name of the thread creating them, an audio or timer thread
+        //SDL started meanwhile has a name of its own
+        if (read_comm(after.tids[i], comm, sizeof(comm)) < 0 || strcmp(comm, before->comm)) {
+            continue;
+        }
+        snprintf(name, sizeof(name), "%s%d", cfg->name[0] ? cfg->name : prefix, n++);
+        apply_settings(after.tids[i], role, name);
+    }
+    pthread_mutex_unlock(&adopt_lock);
+}
+#else
+static int current_tid(void) {
+    return 0;
+}
+
+static void tune_thread(int tid, ThreadRole role) {
+    setting_failed(role, SETTING_CPUS | SETTING_NICE | SETTING_FIFO, "thread tuning", ENOSYS);
+}
+
+static void apply_settings(int tid, ThreadRole role, const char *name) {
+    if (sched_state.configs[role].set) {
+        tune_thread(tid, role);
+    }
+}
+
+void thread_sched_snapshot(ThreadSnapshot *snap) {
+    snap->nb_tids = 0;
+    snap->comm[0] = '\0';
+}
+
+void thread_sched_adopt(ThreadRole role, const ThreadSnapshot *before, const char *prefix) {
+}
+#endif
+
+//the probe sleeps for about 0.1 s, on a thread of its own it stalls neither the audio
+//callback nor the timer: it measures itself once as started, once with the role's settings
+static int probe_thread(void *arg) {
+    ThreadRole role = (ThreadRole)(intptr_t)arg;
+    ThreadLatency *lat = &sched_state.latency[role];
+
+    probe_latency(&lat->before_avg, &lat->before_max);
+    tune_thread(current_tid(), role);
+    probe_latency(&lat->after_avg, &lat->after_max);
+    lat->measured = 1;
+    return 0;
+}
+
+void thread_sched_enter(ThreadRole role) {
+    ThreadConfig *cfg = &sched_state.configs[role];
+    int start_probe = 0;
+
+    if (entered_roles & (1u << role)) {
+        return;
+    }
+    entered_roles |= 1u << role;
+    if (!cfg->set) {
+        return;
+    }
+
+    apply_settings(current_tid(), role, cfg->name);
+    if (sched_state.probe) {
+        //one probe per role, the first thread to enter it starts the probe
+        SDL_AtomicLock(&sched_state.lock);
+        start_probe = NULL == sched_state.probes[role];
+        if (start_probe) {
+            sched_state.probes[role] = (SDL_Thread *)-1;
+        }
+        SDL_AtomicUnlock(&sched_state.lock);
+    }
+    if (start_probe) {
+        SDL_Thread *probe = SDL_CreateThread(probe_thread, "schedlat", (void *)(intptr_t)role);
+        SDL_AtomicLock(&sched_state.lock);
+        sched_state.probes[role] = probe;
+        SDL_AtomicUnlock(&sched_state.lock);
+    }
+}
+
+void thread_sched_report(FILE *out) {
+    int i;
+    for (i = 0; i < THREAD_ROLE_NB; i++) {
+        ThreadLatency *lat = &sched_state.latency[i];
+        SDL_Thread *probe;
+        SDL_AtomicLock(&sched_state.lock);
+        probe = sched_state.probes[i];
+        if (probe && probe != (SDL_Thread *)-1) {
+            sched_state.probes[i] = (SDL_Thread *)-1;
+        } else {
+            probe = NULL;
+        }
+        SDL_AtomicUnlock(&sched_state.lock);
+        if (probe) {
+            SDL_WaitThread(probe, NULL);
+        }
+        if (!sched_state.configs[i].set) {
+            continue;
+        }
+        fprintf(out, "%-8s %d thread(s)%s", role_names[i], sched_state.threads[i],
+                sched_state.failed[i] ? ", some settings refused" : "");
+        if (lat->measured) {
+            fprintf(out, ", wakeup latency avg/max %.0f/%.0f us before, %.0f/%.0f us after",
+                    lat->before_avg, lat->before_max, lat->after_avg, lat->after_max);
+        }
+        fprintf(out, "\n");
+    }
+}
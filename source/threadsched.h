@@ -0,0 +1,53 @@
+#ifndef THREADSCHED_H
+#define THREADSCHED_H
+
+#include <stdio.h>
+
+/* CPU affinity, priority and names of the pipeline threads.
+ *
+ * Configured per role on the command line, e.g. "-thread audio:cpus=2:fifo=40" or
+ * "-thread demux:cpus=0-1,4:nice=5:name=demux". A thread applies its settings itself the
+ * first time it runs as that role. Every setting is tried on its own, one that is refused
+ * (no CAP_SYS_NICE, cpus outside the cpuset) is reported and the thread runs on without it.
+ *
+ * ffmpeg creates its decoder threads inside avcodec_open2, they are found by comparing the
+ * threads of the process before and after, then named and configured as "decoder". */
+typedef enum ThreadRole {
+    THREAD_DEMUX,   //decode_thread, reads packets
+    THREAD_VIDEO,   //video_thread, decodes and converts pictures
+    THREAD_AUDIO,   //SDL audio callback, decodes and resamples
+    THREAD_PRESENT, //main event loop, renders
+    THREAD_TIMER,   //SDL timer thread, schedules the refreshes
+    THREAD_DECODER, //ffmpeg's frame and slice threads
+    THREAD_WAVEFORM, //background pass of the waveform overview
+    THREAD_ROLE_NB
+}ThreadRole;
+
+#define THREAD_SNAPSHOT_MAX 256
+
+typedef struct ThreadSnapshot {
+    int tids[THREAD_SNAPSHOT_MAX];
+    int nb_tids;
+    char comm[16]; //name of the calling thread, new threads inherit it
+}ThreadSnapshot;
+
+//"role:key=value:...", keys cpus, fifo, nice, name
+int thread_sched_parse(const char *spec);
+
+//measure the wakeup latency of each role before and after its settings are applied,
+//on a helper thread so the measured thread itself is not stalled
+void thread_sched_set_probe(int enable);
+
+//cheap after the first call of a thread
+void thread_sched_enter(ThreadRole role);
+
+//holds a lock until thread_sched_adopt, every snapshot must be followed by an adopt
+void thread_sched_snapshot(ThreadSnapshot *snap);
+
+//threads started since the snapshot that still carry the name of the thread that took it,
+//named prefix0, prefix1, ...; one snapshot at a time, so two openings never share new threads
+void thread_sched_adopt(ThreadRole role, const ThreadSnapshot *before, const char *prefix);
+
+void thread_sched_report(FILE *out);
+
+#endif
@@ -0,0 +1,444 @@
+#include <stdio.h>
+#include <string.h>
+#include <libavutil/avstring.h>
+#include <libavutil/time.h>
+#include <libavutil/imgutils.h>
+#include "videoutils.h"
+
+/*
+ * Headless thumbnail mode.
+ *
+ * Every file gets opts->count thumbnails, taken at evenly spread points of its duration,
+ * and a contact sheet with all of them. Only keyframes are decoded: the decoder skips
+ * everything else (skip_frame = AVDISCARD_NONKEY) and non-key packets are not even sent.
+ *
+ * The work is split into jobs handed to a pool of worker threads. With at least as many
+ * files as workers a job is a whole file, otherwise the sample points of each file are
+ * spread over the workers, each with its own demuxer and decoder.
+ */
+#define THUMB_PIX_FMT AV_PIX_FMT_YUVJ420P
+//give up on a sample point when no keyframe shows up within this many packets
+#define THUMB_MAX_PACKETS 4096
+//mjpeg encoders kept per worker, the thumbnail and the sheet sizes of a few files
+#define THUMB_ENCODER_CACHE 4
+
+typedef struct ThumbFile {
+    const char *path;
+    char name[256]; //file name without directory and extension, prefix of the outputs
+    SDL_mutex *mutex;
+    AVFrame *sheet;
+    int thumb_w, thumb_h;
+    int remaining; //sample points not done yet, the last one writes the sheet
+}ThumbFile;
+
+typedef struct ThumbEncoder {
+    AVCodecContext *ctx;
+    int width, height;
+    uint64_t last_used;
+}ThumbEncoder;
+
+typedef struct ThumbEncoders {
+    ThumbEncoder entries[THUMB_ENCODER_CACHE];
+    uint64_t tick;
+}ThumbEncoders;
+
+typedef struct ThumbJob {
+    int file;
+    int first, step; //sample points first, first + step, ...
+}ThumbJob;
+
+typedef struct ThumbContext {
+    const ThumbnailOptions *opts;
+    ThumbFile *files;
+    ThumbJob *jobs;
+    int nb_jobs;
+    SDL_atomic_t next_job;
+    SDL_SpinLock stats_lock;
+    int thumbs_done, thumbs_failed;
+    int64_t thumb_time; //summed over all workers, microseconds
+}ThumbContext;
+
+static void thumbnail_file_name(ThumbFile *file) {
+    const char *base = strrchr(file->path, '/');
+    char *dot;
+
+    av_strlcpy(file->name, base ? base + 1 : file->path, sizeof(file->name));
+    dot = strrchr(file->name, '.');
+    if (dot && dot != file->name) {
+        *dot = '\0';
+    }
+}
+
+static void thumbnail_encoders_free(ThumbEncoders *encoders) {
+    int i;
+    for (i = 0; i < THUMB_ENCODER_CACHE; i++) {
+        avcodec_free_context(&encoders->entries[i].ctx);
+    }
+    memset(encoders, 0, sizeof(ThumbEncoders));
+}
+
+/* The worker's mjpeg encoder for this size, opened on first use. mjpeg is intra only,
+ * an encoder takes any number of pictures of its size. */
+static AVCodecContext *thumbnail_encoder_get(ThumbEncoders *encoders, int width, int height) {
+    AVCodec *codec;
+    ThumbEncoder *victim = &encoders->entries[0];
+    int i;
+
+    encoders->tick++;
+    for (i = 0; i < THUMB_ENCODER_CACHE; i++) {
+        ThumbEncoder *e = &encoders->entries[i];
+        if (e->ctx && e->width == width && e->height == height) {
+            e->last_used = encoders->tick;
+            return e->ctx;
+        }
+        if (NULL == e->ctx || (victim->ctx && e->last_used < victim->last_used)) {
+            victim = e;
+        }
+    }
+
+    codec = avcodec_find_encoder(AV_CODEC_ID_MJPEG);
+    if (NULL == codec) {
+        fprintf(stderr, "No mjpeg encoder\n");
+        return NULL;
+    }
+    avcodec_free_context(&victim->ctx);
+    victim->ctx = avcodec_alloc_context3(codec);
+    if (NULL == victim->ctx) {
+        return NULL;
+    }
+    victim->ctx->width = width;
+    victim->ctx->height = height;
+    victim->ctx->pix_fmt = THUMB_PIX_FMT;
+    victim->ctx->time_base = (AVRational){1, 25};
+    if (avcodec_open2(victim->ctx, codec, NULL) < 0) {
+        avcodec_free_context(&victim->ctx);
+        return NULL;
+    }
+    victim->width = width;
+    victim->height = height;
+    victim->last_used = encoders->tick;
+    return victim->ctx;
+}
+
+static int thumbnail_write_jpeg(ThumbEncoders *encoders, const char *path, AVFrame *frame) {
+    AVCodecContext *codecCtx = thumbnail_encoder_get(encoders, frame->width, frame->height);
+    AVPacket packet;
+    FILE *out;
+    int ret;
+
+    if (NULL == codecCtx) {
+        return -1;
+    }
+
+    av_init_packet(&packet);
+    packet.data = NULL;
+    packet.size = 0;
+    frame->pts = encoders->tick;
+    ret = avcodec_send_frame(codecCtx, frame);
+    if (ret >= 0) {
+        ret = avcodec_receive_packet(codecCtx, &packet);
+    }
+    if (ret >= 0) {
+        out = fopen(path, "wb");
+        if (NULL == out) {
+            fprintf(stderr, "Could not write %s\n", path);
+            ret = -1;
+        } else {
+            fwrite(packet.data, 1, packet.size, out);
+            fclose(out);
+        }
+        av_packet_unref(&packet);
+    }
+    return ret;
+}
+
+/* Seek before ts and decode the first keyframe from there. */
+static int thumbnail_decode_at(AVFormatContext *fmt_ctx, AVCodecContext *codecCtx, int stream_index,
+                               int64_t ts, AVFrame *frame) {
+    AVPacket packet;
+    int nb_packets = 0;
+    int ret;
+
+    if (av_seek_frame(fmt_ctx, -1, ts, AVSEEK_FLAG_BACKWARD) < 0 &&
+            av_seek_frame(fmt_ctx, -1, ts, 0) < 0) {
+        return -1;
+    }
+    avcodec_flush_buffers(codecCtx);
+
+    av_init_packet(&packet);
+    packet.data = NULL;
+    packet.size = 0;
+    while (nb_packets++ < THUMB_MAX_PACKETS) {
+        ret = av_read_frame(fmt_ctx, &packet);
+        if (ret < 0) {
+            //end of file, the decoder may still hold the keyframe
+            avcodec_send_packet(codecCtx, NULL);
+            return avcodec_receive_frame(codecCtx, frame);
+        }
+        if (packet.stream_index != stream_index || !(packet.flags & AV_PKT_FLAG_KEY)) {
+            av_packet_unref(&packet);
+            continue;
+        }
+        ret = avcodec_send_packet(codecCtx, &packet);
+        av_packet_unref(&packet);
+        if (ret < 0 && ret != AVERROR(EAGAIN)) {
+            continue;
+        }
+        ret = avcodec_receive_frame(codecCtx, frame);
+        if (ret != AVERROR(EAGAIN)) {
+            return ret;
+        }
+    }
+    return -1;
+}
+
+//black, full range
+static AVFrame *thumbnail_alloc_sheet(int width, int height) {
+    AVFrame *sheet = av_frame_alloc();
+    if (NULL == sheet) {
+        return NULL;
+    }
+    sheet->width = width;
+    sheet->height = height;
+    sheet->format = THUMB_PIX_FMT;
+    if (av_frame_get_buffer(sheet, FRAME_POOL_ALIGN) < 0) {
+        av_frame_free(&sheet);
+        return NULL;
+    }
+    memset(sheet->data[0], 0, sheet->linesize[0] * height);
+    memset(sheet->data[1], 128, sheet->linesize[1] * (height / 2));
+    memset(sheet->data[2], 128, sheet->linesize[2] * (height / 2));
+    return sheet;
+}
+
+static void thumbnail_copy_tile(AVFrame *sheet, const AVFrame *thumb, int x, int y) {
+    int p;
+    for (p = 0; p < 3; p++) {
+        int shift = p ? 1 : 0;
+        av_image_copy_plane(sheet->data[p] + (y >> shift) * sheet->linesize[p] + (x >> shift),
+                            sheet->linesize[p],
+                            thumb->data[p], thumb->linesize[p],
+                            thumb->width >> shift, thumb->height >> shift);
+    }
+}
+
+/* Called once per sample point, the last one of a file writes and frees the sheet. */
+static void thumbnail_sample_done(ThumbContext *tc, ThumbEncoders *encoders, ThumbFile *file, int count) {
+    char path[1024];
+    AVFrame *sheet = NULL;
+
+    SDL_LockMutex(file->mutex);
+    file->remaining -= count;
+    if (file->remaining == 0) {
+        sheet = file->sheet;
+        file->sheet = NULL;
+    }
+    SDL_UnlockMutex(file->mutex);
+
+    if (sheet) {
+        snprintf(path, sizeof(path), "%s/%s_sheet.jpg", tc->opts->output_dir, file->name);
+        if (thumbnail_write_jpeg(encoders, path, sheet) < 0) {
+            fprintf(stderr, "Failed to write %s\n", path);
+        }
+        av_frame_free(&sheet);
+    }
+}
+
+static void thumbnail_job(ThumbContext *tc, ThumbJob *job, ScalerCache *scalers, FramePool *pool,
+                          ThumbEncoders *encoders, AVFrame *frame, AVFrame *thumb) {
+    const ThumbnailOptions *opts = tc->opts;
+    ThumbFile *file = &tc->files[job->file];
+    AVFormatContext *fmt_ctx = NULL;
+    AVCodecContext *codecCtx = NULL;
+    AVStream *st;
+    int stream_index = -1;
+    int nb_samples = (opts->count - job->first + job->step - 1) / job->step;
+    int64_t start_time, duration;
+    int i;
+
+    if (avformat_open_input(&fmt_ctx, file->path, NULL, NULL) < 0 ||
+            avformat_find_stream_info(fmt_ctx, NULL) < 0 ||
+            open_codec_context(fmt_ctx, &stream_index, &codecCtx, AVMEDIA_TYPE_VIDEO) < 0) {
+        fprintf(stderr, "%s: no decodable video\n", file->path);
+        SDL_AtomicLock(&tc->stats_lock);
+        tc->thumbs_failed += nb_samples;
+        SDL_AtomicUnlock(&tc->stats_lock);
+        thumbnail_sample_done(tc, encoders, file, nb_samples);
+        goto done;
+    }
+    codecCtx->skip_frame = AVDISCARD_NONKEY;
+    for (i = 0; i < (int)fmt_ctx->nb_streams; i++) {
+        if (i != stream_index) {
+            fmt_ctx->streams[i]->discard = AVDISCARD_ALL;
+        }
+    }
+    st = fmt_ctx->streams[stream_index];
+    start_time = fmt_ctx->start_time != AV_NOPTS_VALUE ? fmt_ctx->start_time : 0;
+    duration = fmt_ctx->duration;
+
+    SDL_LockMutex(file->mutex);
+    if (0 == file->thumb_w) {
+        double aspect = (double)codecCtx->width / codecCtx->height;
+        if (st->sample_aspect_ratio.num > 0) {
+            aspect *= av_q2d(st->sample_aspect_ratio);
+        }
+        //even sizes, the tiles are 4:2:0
+        file->thumb_w = FFALIGN(opts->width, 2);
+        file->thumb_h = FFMAX(2, FFALIGN((int)(opts->width / aspect), 2));
+        file->sheet = thumbnail_alloc_sheet(file->thumb_w * opts->columns,
+                                            file->thumb_h * ((opts->count + opts->columns - 1) / opts->columns));
+    }
+    SDL_UnlockMutex(file->mutex);
+
+    for (i = job->first; i < opts->count; i += job->step) {
+        int64_t begin = av_gettime_relative();
+        int64_t ts;
+        int ok = 0;
+
+        if (duration > 0) {
+            ts = start_time + duration * (2 * i + 1) / (2 * opts->count);
+        } else {
+            //unknown duration, one every ten seconds
+            ts = start_time + (int64_t)i * 10 * AV_TIME_BASE;
+        }
+
+        if (thumbnail_decode_at(fmt_ctx, codecCtx, stream_index, ts, frame) == 0) {
+            struct SwsContext *sws_ctx = scaler_cache_get(scalers,
+                    frame->width, frame->height, frame->format,
+                    file->thumb_w, file->thumb_h, THUMB_PIX_FMT);
+            if (sws_ctx && frame_pool_get(pool, thumb, file->thumb_w, file->thumb_h, THUMB_PIX_FMT) == 0) {
+                char path[1024];
+                sws_scale(sws_ctx, (uint8_t const * const *)frame->data, frame->linesize,
+                          0, frame->height, thumb->data, thumb->linesize);
+                snprintf(path, sizeof(path), "%s/%s_%03d.jpg", opts->output_dir, file->name, i);
+                ok = thumbnail_write_jpeg(encoders, path, thumb) >= 0;
+                if (ok && file->sheet) {
+                    //tiles do not overlap, no lock needed
+                    thumbnail_copy_tile(file->sheet, thumb,
+                                        (i % opts->columns) * file->thumb_w,
+                                        (i / opts->columns) * file->thumb_h);
+                }
+                av_frame_unref(thumb);
+            }
+            av_frame_unref(frame);
+        }
+
+        SDL_AtomicLock(&tc->stats_lock);
+        if (ok) {
+            tc->thumbs_done++;
+        } else {
+            tc->thumbs_failed++;
+        }
+        tc->thumb_time += av_gettime_relative() - begin;
+        SDL_AtomicUnlock(&tc->stats_lock);
+        thumbnail_sample_done(tc, encoders, file, 1);
+    }
+
+    done:
+        avcodec_free_context(&codecCtx);
+        if (fmt_ctx) {
+            avformat_close_input(&fmt_ctx);
+        }
+}
+
+static int thumbnail_worker(void *userdata) {
+    ThumbContext *tc = (ThumbContext *)userdata;
+    ScalerCache scalers;
+    FramePool pool;
+    ThumbEncoders encoders;
+    AVFrame *frame = av_frame_alloc();
+    AVFrame *thumb = av_frame_alloc();
+    int job;
+
+    memset(&scalers, 0, sizeof(scalers));
+    memset(&pool, 0, sizeof(pool));
+    memset(&encoders, 0, sizeof(encoders));
+    //thumbnails are tiny, trade quality for speed
+    scalers.flags = SWS_FAST_BILINEAR;
+
+    if (frame && thumb) {
+        while ((job = SDL_AtomicAdd(&tc->next_job, 1)) < tc->nb_jobs) {
+            thumbnail_job(tc, &tc->jobs[job], &scalers, &pool, &encoders, frame, thumb);
+        }
+    }
+
+    av_frame_free(&frame);
+    av_frame_free(&thumb);
+    frame_pool_uninit(&pool);
+    scaler_cache_free(&scalers);
+    thumbnail_encoders_free(&encoders);
+    return 0;
+}
+
+int thumbnail_run(char **files, int nb_files, const ThumbnailOptions *opts) {
+    ThumbContext tc;
+    SDL_Thread **workers;
+    int nb_workers = opts->threads > 0 ? opts->threads : SDL_GetCPUCount();
+    int i, j, ret = 0;
+    int64_t start = av_gettime_relative();
+    double elapsed;
+
+    memset(&tc, 0, sizeof(tc));
+    tc.opts = opts;
+    tc.files = av_mallocz(nb_files * sizeof(ThumbFile));
+    //a file per job, or the sample points of every file spread over all workers
+    tc.jobs = av_mallocz(nb_files * nb_workers * sizeof(ThumbJob));
+    workers = av_mallocz(nb_workers * sizeof(SDL_Thread *));
+    if (NULL == tc.files || NULL == tc.jobs || NULL == workers) {
+        ret = AVERROR(ENOMEM);
+        goto done;
+    }
+
+    for (i = 0; i < nb_files; i++) {
+        ThumbFile *file = &tc.files[i];
+        int split = nb_files >= nb_workers ? 1 : FFMIN(nb_workers, opts->count);
+
+        file->path = files[i];
+        file->remaining = opts->count;
+        file->mutex = SDL_CreateMutex();
+        thumbnail_file_name(file);
+        for (j = 0; j < split; j++) {
+            tc.jobs[tc.nb_jobs].file = i;
+            tc.jobs[tc.nb_jobs].first = j;
+            tc.jobs[tc.nb_jobs].step = split;
+            tc.nb_jobs++;
+        }
+    }
+
+    for (i = 0; i < nb_workers; i++) {
+        workers[i] = SDL_CreateThread(thumbnail_worker, "thumbnail_worker", &tc);
+    }
+    for (i = 0; i < nb_workers; i++) {
+        if (workers[i]) {
+            SDL_WaitThread(workers[i], NULL);
+        } else {
+            //no thread, work on this one
+            thumbnail_worker(&tc);
+        }
+    }
+
+    elapsed = (av_gettime_relative() - start) / 1000000.0;
+    fprintf(stderr, "thumbnails: %d files, %d thumbnails (%d failed) with %d workers in %.2fs: "
+                    "%.1f files/s, %.1f ms/thumbnail wall, %.1f ms/thumbnail per worker\n",
+            nb_files, tc.thumbs_done, tc.thumbs_failed, nb_workers, elapsed,
+            elapsed > 0 ? nb_files / elapsed : 0,
+            tc.thumbs_done ? elapsed * 1000 / tc.thumbs_done : 0,
+            tc.thumbs_done ? tc.thumb_time / 1000.0 / tc.thumbs_done : 0);
+    if (tc.thumbs_failed) {
+        ret = -1;
+    }
+
+    done:
+        if (tc.files) {
+            for (i = 0; i < nb_files; i++) {
+                av_frame_free(&tc.files[i].sheet);
+                if (tc.files[i].mutex) {
+                    SDL_DestroyMutex(tc.files[i].mutex);
+                }
+            }
+        }
+        av_free(tc.files);
+        av_free(tc.jobs);
+        av_free(workers);
+    return ret;
+}
@@ -0,0 +1,297 @@
+#include <stdio.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <inttypes.h>
+#include <SDL2/SDL.h>
+#include <libavutil/common.h>
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+#include <libavutil/avstring.h>
+#include "trace.h"
+
+typedef struct TraceEvent {
+    const char *name;
+    int64_t ts;
+    int64_t value; //counters only
+    char phase;    //B, E, i or C as in the trace format
+}TraceEvent;
+
+typedef struct TraceBuffer {
+    TraceEvent events[TRACE_BUFFER_EVENTS];
+    SDL_atomic_t head; //events written so far, the ring index is head % TRACE_BUFFER_EVENTS
+    SDL_atomic_t in_use; //cleared when the owner exits, another thread may then take the slot
+    const char *name;
+}TraceBuffer;
+
+typedef struct TraceState {
+    TraceBuffer *buffers[TRACE_MAX_THREADS];
+    SDL_atomic_t nb_buffers;
+    volatile int recording;
+    int64_t start_time; //events before it belong to an earlier recording
+    char path[1024];
+}TraceState;
+
+static TraceState trace;
+static __thread TraceBuffer *thread_buffer;
+static __thread int thread_no_buffer;
+static __thread const char *thread_name;
+static volatile sig_atomic_t trace_toggle_req = 0;
+static pthread_once_t trace_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t trace_key;
+
+//the handler may only post the semaphore, a thread pushes the event waking the event loop
+static sem_t wakeup_sem;
+static volatile sig_atomic_t wakeup_ready = 0;
+static volatile int wakeup_quit = 0;
+static uint32_t wakeup_event;
+static SDL_Thread *wakeup_thread;
+
+static void trace_signal(int sig) {
+    trace_toggle_req = 1;
+    if (wakeup_ready) {
+        sem_post(&wakeup_sem);
+    }
+}
+
+static int trace_wakeup_thread(void *userdata) {
+    SDL_Event event;
+
+    for (;;) {
+        while (sem_wait(&wakeup_sem) < 0 && errno == EINTR) {
+        }
+        if (wakeup_quit) {
+            break;
+        }
+        SDL_zero(event);
+        event.type = wakeup_event;
+        SDL_PushEvent(&event);
+    }
+    return 0;
+}
+
+void trace_set_wakeup(uint32_t event_type) {
+    if (wakeup_thread || sem_init(&wakeup_sem, 0, 0) < 0) {
+        return;
+    }
+    wakeup_event = event_type;
+    wakeup_thread = SDL_CreateThread(trace_wakeup_thread, "trace_wakeup", NULL);
+    if (NULL == wakeup_thread) {
+        sem_destroy(&wakeup_sem);
+        return;
+    }
+    wakeup_ready = 1;
+}
+
+static void trace_thread_exit(void *buffer) {
+    SDL_AtomicSet(&((TraceBuffer *)buffer)->in_use, 0);
+}
+
+static void trace_key_init(void) {
+    pthread_key_create(&trace_key, trace_thread_exit);
+}
+
+void trace_init(const char *path, int start) {
+    if (path) {
+        av_strlcpy(trace.path, path, sizeof(trace.path));
+    } else {
+        snprintf(trace.path, sizeof(trace.path), "trace-%d.json", (int)getpid());
+    }
+#ifdef SIGUSR1
+    signal(SIGUSR1, trace_signal);
+#endif
+    if (start) {
+        trace.start_time = av_gettime_relative();
+        trace.recording = 1;
+    }
+}
+
+int trace_enabled(void) {
+    return trace.recording;
+}
+
+//a slot left by an exited thread, preferably one without events of the current recording
+static TraceBuffer *trace_reuse_buffer(void) {
+    int nb_buffers = FFMIN(SDL_AtomicGet(&trace.nb_buffers), TRACE_MAX_THREADS);
+    int pass, i;
+
+    for (pass = 0; pass < 2; pass++) {
+        for (i = 0; i < nb_buffers; i++) {
+            TraceBuffer *buf = SDL_AtomicGetPtr((void **)&trace.buffers[i]);
+            int head;
+            if (NULL == buf || SDL_AtomicGet(&buf->in_use)) {
+                continue;
+            }
+            head = SDL_AtomicGet(&buf->head);
+            if (0 == pass && trace.recording && head > 0 &&
+                    buf->events[(unsigned int)(head - 1) % TRACE_BUFFER_EVENTS].ts >= trace.start_time) {
+                continue;
+            }
+            if (SDL_AtomicCAS(&buf->in_use, 0, 1)) {
+                SDL_AtomicSet(&buf->head, 0);
+                buf->name = thread_name;
+                return buf;
+            }
+        }
+    }
+    return NULL;
+}
+
+static TraceBuffer *trace_get_buffer(void) {
+    TraceBuffer *buf;
+    int slot;
+
+    if (thread_buffer || thread_no_buffer) {
+        return thread_buffer;
+    }
+    pthread_once(&trace_key_once, trace_key_init);
+    buf = trace_reuse_buffer();
+    if (NULL == buf) {
+        if (SDL_AtomicGet(&trace.nb_buffers) >= TRACE_MAX_THREADS ||
+                (slot = SDL_AtomicAdd(&trace.nb_buffers, 1)) >= TRACE_MAX_THREADS) {
+            //every slot is taken by a live thread, or by an exited one still holding the recording
+            buf = trace_reuse_buffer();
+        } else {
+            buf = av_mallocz(sizeof(TraceBuffer));
+            if (buf) {
+                SDL_AtomicSet(&buf->in_use, 1);
+                buf->name = thread_name;
+                //published last, the writer of the file only reads complete buffers
+                SDL_AtomicSetPtr((void **)&trace.buffers[slot], buf);
+            }
+        }
+    }
+    if (NULL == buf) {
+        thread_no_buffer = 1;
+        return NULL;
+    }
+    //the slot is given back when the thread exits
+    pthread_setspecific(trace_key, buf);
+    thread_buffer = buf;
+    return thread_buffer;
+}
+
+static void trace_record(const char *name, char phase, int64_t value) {
+    TraceBuffer *buf;
+    TraceEvent *ev;
+    int head;
+
+    if (!trace.recording || NULL == (buf = trace_get_buffer())) {
+        return;
+    }
+    head = SDL_AtomicGet(&buf->head);
+    ev = &buf->events[(unsigned int)head % TRACE_BUFFER_EVENTS];
+    ev->name = name;
+    ev->ts = av_gettime_relative();
+    ev->value = value;
+    ev->phase = phase;
+    SDL_AtomicSet(&buf->head, head + 1);
+}
+
+//the buffer is only allocated with the first event, threads never traced cost nothing
+void trace_thread_name(const char *name) {
+    thread_name = name;
+    if (thread_buffer) {
+        thread_buffer->name = name;
+    }
+}
+
+void trace_begin(const char *name) {
+    trace_record(name, 'B', 0);
+}
+
+void trace_end(const char *name) {
+    trace_record(name, 'E', 0);
+}
+
+void trace_instant(const char *name) {
+    trace_record(name, 'i', 0);
+}
+
+void trace_counter(const char *name, int64_t value) {
+    trace_record(name, 'C', value);
+}
+
+static void trace_write(void) {
+    FILE *out = fopen(trace.path, "w");
+    int nb_buffers = FFMIN(SDL_AtomicGet(&trace.nb_buffers), TRACE_MAX_THREADS);
+    int64_t nb_events = 0;
+    int i, first = 1;
+
+    if (NULL == out) {
+        fprintf(stderr, "Could not write the trace to %s\n", trace.path);
+        return;
+    }
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (i = 0; i < nb_buffers; i++) {
+        TraceBuffer *buf = SDL_AtomicGetPtr((void **)&trace.buffers[i]);
+        int head, n, j;
+        if (NULL == buf) {
+            continue;
+        }
+        if (buf->name) {
+            fprintf(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                    first ? "" : ",\n", i + 1, buf->name);
+            first = 0;
+        }
+        head = SDL_AtomicGet(&buf->head);
+        //a full ring leaves out the oldest slot, a late writer may be overwriting it
+        n = FFMIN(head, TRACE_BUFFER_EVENTS - 1);
+        for (j = head - n; j != head; j++) {
+            TraceEvent *ev = &buf->events[(unsigned int)j % TRACE_BUFFER_EVENTS];
+            if (ev->ts < trace.start_time) {
+                continue;
+            }
+            fprintf(out, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%"PRId64",\"pid\":1,\"tid\":%d",
+                    first ? "" : ",\n", ev->name, ev->phase, ev->ts - trace.start_time, i + 1);
+            if (ev->phase == 'C') {
+                fprintf(out, ",\"args\":{\"value\":%"PRId64"}", ev->value);
+            } else if (ev->phase == 'i') {
+                fprintf(out, ",\"s\":\"t\"");
+            }
+            fprintf(out, "}");
+            first = 0;
+            nb_events++;
+        }
+    }
+    fprintf(out, "\n]}\n");
+    fclose(out);
+    fprintf(stderr, "trace: %"PRId64" events of %d threads written to %s\n", nb_events, nb_buffers, trace.path);
+}
+
+void trace_poll(void) {
+    if (!trace_toggle_req) {
+        return;
+    }
+    trace_toggle_req = 0;
+    if (trace.recording) {
+        trace.recording = 0;
+        trace_write();
+    } else {
+        trace.start_time = av_gettime_relative();
+        trace.recording = 1;
+        fprintf(stderr, "trace: recording, send SIGUSR1 again to write %s\n", trace.path);
+    }
+}
+
+void trace_uninit(void) {
+    int i;
+    if (wakeup_thread) {
+        wakeup_ready = 0;
+        wakeup_quit = 1;
+        sem_post(&wakeup_sem);
+        SDL_WaitThread(wakeup_thread, NULL);
+        wakeup_thread = NULL;
+        sem_destroy(&wakeup_sem);
+    }
+    if (trace.recording) {
+        trace.recording = 0;
+        trace_write();
+    }
+    //buffers of exited threads are reused, they are all freed here
+    for (i = 0; i < TRACE_MAX_THREADS; i++) {
+        av_freep(&trace.buffers[i]);
+    }
+}
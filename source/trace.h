@@ -0,0 +1,42 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+/* Timeline of the pipeline in the Chrome trace event format, for chrome://tracing or
+ * ui.perfetto.dev.
+ *
+ * Every thread records into its own ring of the last TRACE_BUFFER_EVENTS events, only the
+ * owner writes it, so recording takes no lock. Names must be string literals, only the
+ * pointer is stored. Recording runs from the start with -trace, or is toggled by SIGUSR1:
+ * the first signal starts it, the second one writes the file. A thread that exits gives its
+ * ring back, the next new thread reuses it, so at most TRACE_MAX_THREADS rings are live. */
+#define TRACE_BUFFER_EVENTS (1 << 16)
+#define TRACE_MAX_THREADS 64
+
+//NULL picks trace-<pid>.json
+void trace_init(const char *path, int start);
+
+int trace_enabled(void);
+
+//a name for the calling thread in the timeline
+void trace_thread_name(const char *name);
+
+void trace_begin(const char *name);
+
+void trace_end(const char *name);
+
+void trace_instant(const char *name);
+
+void trace_counter(const char *name, int64_t value);
+
+//from the event loop: acts on a SIGUSR1 received since the last call
+void trace_poll(void);
+
+//an event of this type is pushed on SIGUSR1, so an idle event loop gets to trace_poll
+void trace_set_wakeup(uint32_t event_type);
+
+//writes what is recorded, if recording
+void trace_uninit(void);
+
+#endif
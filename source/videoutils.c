@@ -1,5 +1,25 @@
 #include "videoutils.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <libavutil/imgutils.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define AV_NOSYNC_THRESHOLD 10.0
+#define AV_SYNC_THRESHOLD_MIN 0.04
+#define AV_SYNC_THRESHOLD_MAX 0.1
+/* If a frame duration is longer than this, it will not be duplicated(means add diff to delay, instead to 2 * delay) to compensate AV sync */
+#define AV_SYNC_FRAMEDUP_THRESHOLD 0.1
+
+AVPacket flush_pkt;
+
+static SDL_atomic_t packet_node_alloc_count;
+
+int packet_node_allocations(void) {
+    return SDL_AtomicGet(&packet_node_alloc_count);
+}
 
 void packet_queue_init(PacketQueue *queue) {
     memset(queue, 0, sizeof(PacketQueue));
@@ -7,26 +27,41 @@ void packet_queue_init(PacketQueue *queue) {
     queue->cond = SDL_CreateCond();
 }
 
-int packet_queue_put(PacketQueue *queue, const AVPacket *pkt) {
+int packet_queue_put(PacketQueue *queue, AVPacket *pkt) {
     if (NULL == pkt) {
         return -1;
     }
     AVPacket newPkt;
     av_init_packet(&newPkt);
     newPkt.data = pkt->data;
-    if ((pkt != &flush_pkt) && av_packet_ref(&newPkt, pkt) < 0) {
+    newPkt.size = 0;
+    if (pkt == &flush_pkt || NULL == pkt->data) {
+        //flush_pkt and the empty end of file packet carry no payload
+    } else if (pkt->buf) {
+        //the demuxer's buffer is queued as it is, no copy and no new reference
+        av_packet_move_ref(&newPkt, pkt);
+    } else if (av_packet_ref(&newPkt, pkt) < 0) {
         return -1;
     }
 
-    AVPacketList *pktl = av_malloc(sizeof(AVPacketList));
-    if (NULL == pktl) {
-        return -1;
+    SDL_LockMutex(queue->mutex);
+
+    AVPacketList *pktl = queue->free_nodes;
+    if (pktl) {
+        queue->free_nodes = pktl->next;
+        queue->nb_free_nodes--;
+    } else {
+        pktl = av_malloc(sizeof(AVPacketList));
+        if (NULL == pktl) {
+            SDL_UnlockMutex(queue->mutex);
+            av_packet_unref(&newPkt);
+            return -1;
+        }
+        SDL_AtomicAdd(&packet_node_alloc_count, 1);
     }
     pktl->pkt = newPkt;
     pktl->next = NULL;
 
-    SDL_LockMutex(queue->mutex);
-
     if (!queue->first_pkt) { // queue is empty
         queue->first_pkt = pktl;
     } else { // queue is not empty
@@ -35,12 +70,23 @@ int packet_queue_put(PacketQueue *queue, const AVPacket *pkt) {
     queue->last_pkt = pktl;
     queue->nb_packets++;
     queue->size += pktl->pkt.size;
+    queue->duration += pktl->pkt.duration;
+    mem_budget_add(MEM_PACKETS, sizeof(AVPacketList) + pktl->pkt.size);
     SDL_CondSignal(queue->cond);
 
     SDL_UnlockMutex(queue->mutex);
     return 0;
 }
 
+/* An empty packet, the decoder thread taking it drains its decoder. */
+int packet_queue_put_nullpacket(PacketQueue *queue) {
+    AVPacket pkt;
+    av_init_packet(&pkt);
+    pkt.data = NULL;
+    pkt.size = 0;
+    return packet_queue_put(queue, &pkt);
+}
+
 
 int packet_queue_get(PacketQueue *queue, AVPacket *pkt, int block, int *quit) {
     AVPacketList *pktl;
@@ -62,11 +108,15 @@ int packet_queue_get(PacketQueue *queue, AVPacket *pkt, int block, int *quit) {
             }
             queue->nb_packets--;
             queue->size -= pktl->pkt.size;
+            queue->duration -= pktl->pkt.duration;
+            mem_budget_sub(MEM_PACKETS, sizeof(AVPacketList) + pktl->pkt.size);
             *pkt = pktl->pkt;
-            av_free(pktl);
+            pktl->next = queue->free_nodes;
+            queue->free_nodes = pktl;
+            queue->nb_free_nodes++;
             ret = 1;
             break;
-        } else if (!block) {
+        } else if (!block || queue->paused) {
             ret = 0;
             break;
         } else {
@@ -77,23 +127,231 @@ int packet_queue_get(PacketQueue *queue, AVPacket *pkt, int block, int *quit) {
     return ret;
 }
 
+/* While paused a blocked packet_queue_get returns 0 without a packet, and so does every
+ * later one until the pause ends: a get that starts after the wakeup can not miss it. */
+void packet_queue_set_paused(PacketQueue *q, int paused) {
+    SDL_LockMutex(q->mutex);
+    q->paused = paused;
+    SDL_CondBroadcast(q->cond);
+    SDL_UnlockMutex(q->mutex);
+}
+
+static void packet_queue_free_nodes(AVPacketList *pktList) {
+    AVPacketList *npktList;
+    for (; pktList != NULL; pktList = npktList) {
+        npktList = pktList->next;
+        av_free(pktList);
+    }
+}
+
 void packet_queue_flush(PacketQueue *q) {
-    AVPacketList *pktList, *npktList;
+    AVPacketList *pktList, *npktList, *released = NULL;
 
     SDL_LockMutex(q->mutex);
     for(pktList=q->first_pkt; pktList != NULL; pktList=npktList) {
         npktList = pktList->next;
+        mem_budget_sub(MEM_PACKETS, sizeof(AVPacketList) + pktList->pkt.size);
         av_packet_unref(&(pktList->pkt));
-        av_freep(&pktList);
+        pktList->next = q->free_nodes;
+        q->free_nodes = pktList;
+        q->nb_free_nodes++;
     }
     q->last_pkt = NULL;
     q->first_pkt = NULL;
     q->nb_packets = 0;
     q->size = 0;
+    q->duration = 0;
+    //keep enough nodes to refill after a seek, a full queue of a high bitrate file needs no more
+    while (q->nb_free_nodes > PACKET_QUEUE_KEEP_NODES) {
+        pktList = q->free_nodes;
+        q->free_nodes = pktList->next;
+        q->nb_free_nodes--;
+        pktList->next = released;
+        released = pktList;
+    }
     SDL_UnlockMutex(q->mutex);
+    packet_queue_free_nodes(released);
+
+}
+
+//every thread using the queue is gone
+void packet_queue_destroy(PacketQueue *q) {
+    if (NULL == q->mutex) {
+        return;
+    }
+    packet_queue_flush(q);
+    packet_queue_free_nodes(q->free_nodes);
+    q->free_nodes = NULL;
+    q->nb_free_nodes = 0;
+    SDL_DestroyMutex(q->mutex);
+    SDL_DestroyCond(q->cond);
+    q->mutex = NULL;
+    q->cond = NULL;
+}
+
+
+struct SwsContext *scaler_cache_get(ScalerCache *cache,
+                                    int src_w, int src_h, enum AVPixelFormat src_fmt,
+                                    int dst_w, int dst_h, enum AVPixelFormat dst_fmt) {
+    ScalerCacheEntry *entry, *victim = &cache->entries[0];
+    int i;
 
+    cache->tick++;
+    for (i = 0; i < SCALER_CACHE_SIZE; i++) {
+        entry = &cache->entries[i];
+        if (entry->ctx &&
+                entry->src_w == src_w && entry->src_h == src_h && entry->src_fmt == src_fmt &&
+                entry->dst_w == dst_w && entry->dst_h == dst_h && entry->dst_fmt == dst_fmt) {
+            entry->last_used = cache->tick;
+            cache->hits++;
+            return entry->ctx;
+        }
+        if (NULL == entry->ctx) {
+            victim = entry;
+        } else if (victim->ctx && entry->last_used < victim->last_used) {
+            victim = entry;
+        }
+    }
+
+    cache->misses++;
+    if (victim->ctx) {
+        sws_freeContext(victim->ctx);
+    }
+    victim->ctx = sws_getContext(src_w, src_h, src_fmt,
+                                 dst_w, dst_h, dst_fmt,
+                                 cache->flags ? cache->flags : SWS_BILINEAR, NULL, NULL, NULL);
+    victim->src_w = src_w;
+    victim->src_h = src_h;
+    victim->src_fmt = src_fmt;
+    victim->dst_w = dst_w;
+    victim->dst_h = dst_h;
+    victim->dst_fmt = dst_fmt;
+    victim->last_used = cache->tick;
+    return victim->ctx;
 }
 
+void scaler_cache_free(ScalerCache *cache) {
+    int i;
+    for (i = 0; i < SCALER_CACHE_SIZE; i++) {
+        if (cache->entries[i].ctx) {
+            sws_freeContext(cache->entries[i].ctx);
+        }
+    }
+    memset(cache, 0, sizeof(ScalerCache));
+}
+
+static SDL_atomic_t frame_pool_alloc_count;
+
+static void frame_pool_buffer_free(void *opaque, uint8_t *data) {
+    mem_budget_sub(MEM_PICTURES, (int64_t)(intptr_t)opaque);
+    free(data);
+}
+
+static AVBufferRef *frame_pool_buffer_alloc(void *opaque, int size) {
+    FramePool *fp = (FramePool *)opaque;
+    AVBufferRef *buf;
+    size_t alloc_size = size;
+    size_t align = FRAME_POOL_ALIGN;
+    void *data = NULL;
+
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if (fp->hugepages) {
+        align = HUGE_PAGE_SIZE;
+        alloc_size = FFALIGN(alloc_size, HUGE_PAGE_SIZE);
+    }
+#endif
+    if (posix_memalign(&data, align, alloc_size) != 0) {
+        return NULL;
+    }
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if (fp->hugepages) {
+        //only a hint, the kernel may refuse or be configured without THP
+        madvise(data, alloc_size, MADV_HUGEPAGE);
+    }
+#endif
+    buf = av_buffer_create(data, size, frame_pool_buffer_free, (void *)(intptr_t)alloc_size, 0);
+    if (NULL == buf) {
+        free(data);
+        return NULL;
+    }
+    mem_budget_add(MEM_PICTURES, alloc_size);
+    SDL_AtomicAdd(&frame_pool_alloc_count, 1);
+    return buf;
+}
+
+int frame_pool_get(FramePool *fp, AVFrame *frame, int width, int height, enum AVPixelFormat format) {
+    int ret;
+
+    if (NULL == fp->pool || fp->width != width || fp->height != height || fp->format != format) {
+        av_buffer_pool_uninit(&fp->pool);
+        //room for the SIMD writes of sws_scale past the last row
+        fp->size = av_image_get_buffer_size(format, width, height, FRAME_POOL_ALIGN) + FRAME_POOL_ALIGN;
+        if (fp->size <= FRAME_POOL_ALIGN) {
+            return -1;
+        }
+        fp->pool = av_buffer_pool_init2(fp->size, fp, frame_pool_buffer_alloc, NULL);
+        if (NULL == fp->pool) {
+            return AVERROR(ENOMEM);
+        }
+        fp->width = width;
+        fp->height = height;
+        fp->format = format;
+    }
+
+    frame->buf[0] = av_buffer_pool_get(fp->pool);
+    if (NULL == frame->buf[0]) {
+        return AVERROR(ENOMEM);
+    }
+    ret = av_image_fill_arrays(frame->data, frame->linesize, frame->buf[0]->data,
+                               format, width, height, FRAME_POOL_ALIGN);
+    if (ret < 0) {
+        av_buffer_unref(&frame->buf[0]);
+        return ret;
+    }
+    frame->extended_data = frame->data;
+    frame->width = width;
+    frame->height = height;
+    frame->format = format;
+    return 0;
+}
+
+void frame_pool_uninit(FramePool *fp) {
+    av_buffer_pool_uninit(&fp->pool);
+    fp->width = fp->height = 0;
+}
+
+int frame_pool_allocations(void) {
+    return SDL_AtomicGet(&frame_pool_alloc_count);
+}
+
+int64_t frame_buffer_size(const AVFrame *frame) {
+    int64_t size = 0;
+    int i;
+
+    for (i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i]; i++) {
+        size += frame->buf[i]->size;
+    }
+    return size;
+}
+
+
+double video_sync_delay(double delay, double diff) {
+    // sync_threshold = (delay > AV_SYNC_THRESHOLD) ? delay : AV_SYNC_THRESHOLD;
+    // min < delay < max, then delay
+    // delay < min, then min
+    // delay > max, then max
+    double sync_threshold = FFMAX(AV_SYNC_THRESHOLD_MIN, FFMIN(AV_SYNC_THRESHOLD_MAX, delay));
+    if (fabs(diff) < AV_NOSYNC_THRESHOLD) {
+        if (diff <= -sync_threshold) { // video play slower than audio, need to get video faster, so the video delay need to be smaller
+            delay = FFMAX(0, delay + diff);
+        } else if (diff >= sync_threshold && delay > AV_SYNC_FRAMEDUP_THRESHOLD) {//video faster then audio, longer the delay to make video wait audio, as the delay is too big than normal video fram duration, we use delay+diff instead 2*delay, to in case delay too big
+            delay = delay + diff;
+        } else if (diff >= sync_threshold) {//video faster than audio, and the delay is not too big, so directly double the delay
+            delay = 2 * delay;
+        }
+    }
+    return delay;
+}
 
 void SaveFrame(AVFrame *pFrame, int width, int height, int iFrame) {
     FILE *pFile;
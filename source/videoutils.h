@@ -4,24 +4,62 @@
 #include <libswscale/swscale.h>
 #include <libswresample/swresample.h>
 #include <SDL2/SDL.h>
+#include "membudget.h"
 
-#define VIDEO_PICTURE_QUEUE_SIZE 2
+#define VIDEO_PICTURE_QUEUE_SIZE 2 //default depth
+#define VIDEO_PICTURE_QUEUE_MAX 16
+#define FRAME_POOL_ALIGN 64
+#define SCALER_CACHE_SIZE 4
+#define PACKET_QUEUE_KEEP_NODES 256 //recycled list nodes kept over a flush
 #define AVCODEC_MAX_AUDIO_FRAME_SIZE 192000
+#define AUDIO_BUF_SIZE ((AVCODEC_MAX_AUDIO_FRAME_SIZE * 3) / 2)
 
 typedef struct PacketQueue {
     AVPacketList *first_pkt, *last_pkt;
+    AVPacketList *free_nodes; //recycled list nodes, under mutex
+    int nb_free_nodes;
     int nb_packets;
     int size;
+    int64_t duration; //sum of the packet durations, in the time base of the stream
+    int paused; //a blocking get returns 0 instead of waiting, checked under mutex
     SDL_mutex *mutex;
     SDL_cond *cond;
 }PacketQueue;
 
+/* A few converters, so streams that switch between sizes or formats do not rebuild one
+ * on every switch. Least recently used entries are replaced. */
+typedef struct ScalerCacheEntry {
+    struct SwsContext *ctx;
+    int src_w, src_h, dst_w, dst_h;
+    enum AVPixelFormat src_fmt, dst_fmt;
+    int64_t last_used;
+}ScalerCacheEntry;
+
+typedef struct ScalerCache {
+    ScalerCacheEntry entries[SCALER_CACHE_SIZE];
+    int64_t tick;
+    int hits, misses;
+    int flags; //SWS_ scaling algorithm, 0 for SWS_BILINEAR
+}ScalerCache;
+
+/* Picture buffers recycled through an AVBufferPool, one buffer holds all planes with
+ * FRAME_POOL_ALIGN aligned rows. A size or format change starts a new pool, buffers of
+ * the old one are freed when their last reference goes. */
+typedef struct FramePool {
+    AVBufferPool *pool;
+    int width, height;
+    enum AVPixelFormat format;
+    int size;
+    int hugepages; //back buffers with transparent huge pages where available
+}FramePool;
+
 typedef struct VideoPicture {
     AVFrame *pictYUV;
     // uint8_t *data[AV_NUM_DATA_POINTERS];
     // int linesize[AV_NUM_DATA_POINTERS];
     double pts;
     int width, height;
+    int reverse; //queued by the reverse playback threads
 }VideoPicture;
 
 typedef struct VideoState {
@@ -37,7 +75,8 @@ typedef struct VideoState {
     AVCodecContext *audioCodecCtx;
     PacketQueue audioq;
     struct SwrContext *swr_ctx;
-    uint8_t audio_buf[(AVCODEC_MAX_AUDIO_FRAME_SIZE * 3) / 2];
+    uint8_t *audio_buf; //AUDIO_BUF_SIZE bytes, allocated when the audio stream opens
+    unsigned int audio_buf_alloc;
     unsigned int audio_buf_size;
     unsigned int audio_buf_index;
     uint8_t *audio_pke_data;
@@ -46,33 +85,166 @@ typedef struct VideoState {
     AVStream *video_stm;
     AVCodecContext *videoCodecCtx;
     PacketQueue videoq;
-    struct SwsContext *sws_ctx;
-    VideoPicture pict_q[VIDEO_PICTURE_QUEUE_SIZE];
+    ScalerCache scalers; //only used by queue_picture, under pictq_write_mutex
+    int src_width, src_height, src_format; //format of the last decoded frame
+    VideoPicture pict_q[VIDEO_PICTURE_QUEUE_MAX];
+    int pictq_depth;
     int pictq_size, pictq_rindex, pictq_windex;
+    FramePool picture_pool;
+    int pictq_trimmed; //the pool was emptied since the memory budget was exceeded, writer side
     SDL_mutex *pictq_mutex;
     SDL_cond *pictq_cond;
+    SDL_mutex *pictq_write_mutex; //forward and reverse threads both write pictures
     
     SDL_Thread *parse_tid;
     SDL_Thread *video_tid;
 
+    //runtime audio track switch, handed from the demuxer to the audio callback through a flush packet
+    int audio_switch_req;
+    AVCodecContext *audio_pending_ctx;
+    int audio_pending_index;
+
+    //live mode, newest demuxed pts of the clock stream and when it arrived
+    double live_last_pts;
+    int64_t live_last_time;
+    int64_t live_report_time;
+    double live_latency_sum, live_latency_max;
+    int live_latency_count;
+    int live_audio_dropped, live_video_dropped;
+
+    //bench mode counters, bytes/packets returned by av_read_frame
+    int64_t bench_start;
+    int64_t bench_last;
+    int64_t bench_read_pkts, bench_read_bytes;
+    int64_t bench_unused_pkts, bench_unused_bytes;
+
     char filename[1024];
     int quit;
     int seek_req;
     int seek_flags;
     int64_t seek_pos;
+
+    //pause, the demux thread parks on pause_cond and the refresh timer stops
+    int paused;
+    int refresh_parked;
+    int64_t pause_time;
+    SDL_mutex *pause_mutex;
+    SDL_cond *pause_cond;
+
+    //reverse playback, the forward demuxer idles while set
+    int reverse;
+    struct ReverseState *rev;
+
+    //seek bar overview, fed by the audio callback and drawn by the event loop
+    struct Waveform *waveform;
+
+    //counters for the stats export, each written by one thread only
+    int64_t frames_decoded;   //video thread
+
+    //-framehash: set by the decoder threads once they gave out every frame after the end of file
+    int video_drained;
+    int audio_drained;
+    int64_t frames_displayed; //event loop
+    int64_t audio_underruns;  //audio callback
+    double av_drift;          //event loop, video pts - audio clock of the last displayed picture
 }VideoState;
 
 
-AVPacket flush_pkt;
+extern AVPacket flush_pkt;
 
 void packet_queue_init(PacketQueue *queue);
 
-int packet_queue_put(PacketQueue *queue, const AVPacket *pkt);
+//takes over the reference of pkt, which is left blank, flush_pkt excepted
+int packet_queue_put(PacketQueue *queue, AVPacket *pkt);
+int packet_queue_put_nullpacket(PacketQueue *queue);
 
 int packet_queue_get(PacketQueue *queue, AVPacket *pkt, int block, int *quit);
 
+void packet_queue_set_paused(PacketQueue *q, int paused);
+
 void packet_queue_flush(PacketQueue *q);
 
+void packet_queue_destroy(PacketQueue *q);
+
+//list nodes the packet queues had to allocate, flat once the queues have been full
+int packet_node_allocations(void);
+
+struct SwsContext *scaler_cache_get(ScalerCache *cache,
+                                    int src_w, int src_h, enum AVPixelFormat src_fmt,
+                                    int dst_w, int dst_h, enum AVPixelFormat dst_fmt);
+
+void scaler_cache_free(ScalerCache *cache);
+
+int frame_pool_get(FramePool *fp, AVFrame *frame, int width, int height, enum AVPixelFormat format);
+
+void frame_pool_uninit(FramePool *fp);
+
+//number of buffers the frame pools had to allocate, flat once playback is warmed up
+int frame_pool_allocations(void);
+
+//bytes held by the reference counted buffers of a frame
+int64_t frame_buffer_size(const AVFrame *frame);
+
+//the A/V sync rule of video_refresh_timer: how long to show a picture of nominal duration
+//delay that is diff seconds ahead of the reference clock
+double video_sync_delay(double delay, double diff);
+
+/* player internals shared with the other modules, defined in main.c */
+int open_codec_context(AVFormatContext *fmt_ctx, int *stream_idx, AVCodecContext **dec_ctx, enum AVMediaType type);
+
+int queue_picture(VideoState *vs, AVFrame *pFrame, double pts, int reverse);
+
+void stream_seek(VideoState *is, int64_t pos, int rel);
+
+double get_audio_clock(VideoState *vs);
+
+/* stats export to shared memory, stats.c */
+//NULL names the block after the pid
+int stats_open(const char *name);
+
+//wakes the event loop with an event of this type once per update, also while paused
+int stats_start_timer(uint32_t event_type);
+
+void stats_publish(VideoState *vs);
+
+void stats_close(void);
+
+/* thumbnail mode, thumbnail.c */
+typedef struct ThumbnailOptions {
+    int count; //thumbnails per file
+    int width; //of one thumbnail, the height follows the aspect ratio
+    int columns; //of the contact sheet
+    int threads; //workers, 0 for one per cpu
+    const char *output_dir;
+}ThumbnailOptions;
+
+int thumbnail_run(char **files, int nb_files, const ThumbnailOptions *opts);
+
+/* mosaic mode, mosaic.c */
+typedef struct MosaicOptions {
+    int count; //tiles, fewer files than tiles are repeated
+    int tile_width; //the height is 16:9 of it, pictures are letterboxed
+    int columns; //0 for a square grid
+    int duration; //seconds to run, 0 until the window is closed
+    int pool; //pipelines run as tasks on a shared pool instead of a thread each
+    int threads; //pool workers, 0 for one per cpu
+}MosaicOptions;
+
+int mosaic_run(char **files, int nb_files, const MosaicOptions *opts);
+
+/* probe mode, probe.c */
+typedef struct ProbeOptions {
+    int threads; //workers, 0 for one per cpu
+    const char *cache_path; //NULL for no cache
+}ProbeOptions;
+
+int probe_run(char **files, int nb_files, const ProbeOptions *opts);
+
+/* reverse playback, reverse.c */
+int reverse_start(VideoState *vs);
+
+void reverse_stop(VideoState *vs);
+
 
 
 
@@ -0,0 +1,778 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include <libavutil/avstring.h>
+#include <libavutil/time.h>
+#include "videoutils.h"
+#include "waveform.h"
+#include "threadsched.h"
+#include "trace.h"
+
+#define WAVEFORM_MAGIC "WAVEPYR1"
+#define WAVEFORM_PENDING 64 //finished bins the audio callback keeps while the lock is taken
+#define WAVEFORM_SEEK_GAP (2 * WAVEFORM_BIN_RATE) //covered bins ahead worth a seek of the background pass
+#define WAVEFORM_RESCANS 2 //passes over the holes left behind the background pass
+#define WAVEFORM_SCAN_CHUNK 4096 //bins wave_next_missing looks at per lock
+
+typedef struct WaveBin {
+    int16_t min, max; //min > max while empty
+    float power; //mean square, 1.0 is full scale
+}WaveBin;
+
+//samples of the bin being filled
+typedef struct WaveAccum {
+    int64_t pos; //sample position of the next sample, -1 before the first
+    int64_t bin;
+    int rate, channels;
+    int min, max;
+    int64_t sumsq, count;
+    int64_t pending_index[WAVEFORM_PENDING];
+    WaveBin pending[WAVEFORM_PENDING];
+    int nb_pending;
+}WaveAccum;
+
+/* The sidecar file, host byte order: the header, then the base bins. A cache of this
+ * machine, not an exchange format. */
+typedef struct WaveHeader {
+    char magic[8];
+    int64_t file_size, file_mtime;
+    int64_t nb_bins;
+    int32_t stream_index, bin_rate;
+    int32_t complete, reserved;
+}WaveHeader;
+
+struct Waveform {
+    char filename[1024];
+    char sidecar[1040]; //empty when the input is not a local file
+    char cached[1040]; //per user copy, for files in directories we can not write
+    int stream_index;
+    double start_time, duration;
+    int64_t file_size, file_mtime;
+
+    WaveBin *levels[WAVEFORM_MAX_LEVELS];
+    int64_t nb_bins[WAVEFORM_MAX_LEVELS];
+    int nb_levels;
+    int64_t levels_size; //accounted as MEM_WAVEFORM
+    SDL_SpinLock lock; //the bins, only tried by the audio callback
+    SDL_mutex *mutex; //taken before the lock by the sides that wait for it
+    int dirty; //bins stored since the sidecar was read
+    int complete; //the background pass saw the whole stream
+    volatile int64_t end_bin; //bins from here on do not exist, known at the end of the stream
+
+    WaveAccum play; //audio callback only
+    SDL_Thread *scan_tid;
+    volatile int quit;
+
+    //main thread only
+    SDL_Rect *rects;
+    int nb_rects_alloc;
+    int64_t draws, draw_time_max;
+};
+
+/* min, max and sum of squares of n interleaved s16 values, folded into the running ones.
+ * SSE2 takes 8 values a step; the squares of a pair are summed by madd and can reach 2^31,
+ * so they are widened to 64 bit unsigned before accumulating. */
+static void wave_reduce_s16(const int16_t *samples, int n, int *pmin, int *pmax, int64_t *psumsq) {
+    int lo = *pmin, hi = *pmax;
+    int64_t sumsq = *psumsq;
+    int i = 0;
+
+#ifdef __SSE2__
+    if (n >= 8) {
+        __m128i vmin = _mm_set1_epi16(INT16_MAX), vmax = _mm_set1_epi16(INT16_MIN);
+        __m128i vsum = _mm_setzero_si128(), zero = _mm_setzero_si128();
+        int16_t lanes_min[8], lanes_max[8];
+        uint64_t sums[2];
+        int k;
+
+        for (; i + 8 <= n; i += 8) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(samples + i));
+            __m128i sq = _mm_madd_epi16(v, v);
+            vmin = _mm_min_epi16(vmin, v);
+            vmax = _mm_max_epi16(vmax, v);
+            vsum = _mm_add_epi64(vsum, _mm_unpacklo_epi32(sq, zero));
+            vsum = _mm_add_epi64(vsum, _mm_unpackhi_epi32(sq, zero));
+        }
+        _mm_storeu_si128((__m128i *)lanes_min, vmin);
+        _mm_storeu_si128((__m128i *)lanes_max, vmax);
+        _mm_storeu_si128((__m128i *)sums, vsum);
+        for (k = 0; k < 8; k++) {
+            lo = FFMIN(lo, lanes_min[k]);
+            hi = FFMAX(hi, lanes_max[k]);
+        }
+        sumsq += (int64_t)(sums[0] + sums[1]);
+    }
+#endif
+    for (; i < n; i++) {
+        lo = FFMIN(lo, samples[i]);
+        hi = FFMAX(hi, samples[i]);
+        sumsq += samples[i] * samples[i];
+    }
+    *pmin = lo;
+    *pmax = hi;
+    *psumsq = sumsq;
+}
+
+static WaveBin wave_merge(const WaveBin *bins, int64_t n) {
+    WaveBin out = { INT16_MAX, INT16_MIN, 0.0f };
+    int64_t i, filled = 0;
+
+    for (i = 0; i < n; i++) {
+        if (bins[i].min <= bins[i].max) {
+            out.min = FFMIN(out.min, bins[i].min);
+            out.max = FFMAX(out.max, bins[i].max);
+            out.power += bins[i].power;
+            filled++;
+        }
+    }
+    if (filled) {
+        out.power /= filled;
+    }
+    return out;
+}
+
+static void wave_update_parents(Waveform *wf, int64_t index) {
+    int level;
+
+    for (level = 1; level < wf->nb_levels; level++) {
+        int64_t first;
+        index /= WAVEFORM_FANOUT;
+        first = index * WAVEFORM_FANOUT;
+        wf->levels[level][index] = wave_merge(wf->levels[level - 1] + first,
+                                              FFMIN(WAVEFORM_FANOUT, wf->nb_bins[level - 1] - first));
+    }
+}
+
+static void wave_rebuild(Waveform *wf) {
+    int level;
+    int64_t i;
+
+    for (level = 1; level < wf->nb_levels; level++) {
+        for (i = 0; i < wf->nb_bins[level]; i++) {
+            int64_t first = i * WAVEFORM_FANOUT;
+            wf->levels[level][i] = wave_merge(wf->levels[level - 1] + first,
+                                              FFMIN(WAVEFORM_FANOUT, wf->nb_bins[level - 1] - first));
+        }
+    }
+}
+
+/* The drawing and the background pass sleep on the mutex, so they never spin behind
+ * each other; the spin lock then only waits for the audio callback, which holds it
+ * for a few bins and never waits itself. */
+static void wave_lock(Waveform *wf) {
+    SDL_LockMutex(wf->mutex);
+    SDL_AtomicLock(&wf->lock);
+}
+
+static void wave_unlock(Waveform *wf) {
+    SDL_AtomicUnlock(&wf->lock);
+    SDL_UnlockMutex(wf->mutex);
+}
+
+//under the lock
+static void wave_store_pending(Waveform *wf, WaveAccum *acc) {
+    int i;
+
+    for (i = 0; i < acc->nb_pending; i++) {
+        int64_t index = acc->pending_index[i];
+        if (index >= 0 && index < wf->nb_bins[0]) {
+            wf->levels[0][index] = acc->pending[i];
+            wave_update_parents(wf, index);
+            wf->dirty = 1;
+        }
+    }
+    acc->nb_pending = 0;
+}
+
+static void wave_flush(Waveform *wf, WaveAccum *acc, int blocking) {
+    if (0 == acc->nb_pending) {
+        return;
+    }
+    if (blocking) {
+        wave_lock(wf);
+        wave_store_pending(wf, acc);
+        wave_unlock(wf);
+    } else if (SDL_AtomicTryLock(&wf->lock)) {
+        wave_store_pending(wf, acc);
+        SDL_AtomicUnlock(&wf->lock);
+    }
+}
+
+static void wave_accum_clear(WaveAccum *acc) {
+    acc->min = INT16_MAX;
+    acc->max = INT16_MIN;
+    acc->sumsq = 0;
+    acc->count = 0;
+}
+
+static void wave_accum_push(Waveform *wf, WaveAccum *acc, int blocking) {
+    if (acc->nb_pending == WAVEFORM_PENDING) {
+        if (blocking) {
+            wave_flush(wf, acc, 1);
+        } else {
+            //the lock was busy for a whole queue of bins, the background pass fills the gap
+            memmove(acc->pending_index, acc->pending_index + 1, (WAVEFORM_PENDING - 1) * sizeof(int64_t));
+            memmove(acc->pending, acc->pending + 1, (WAVEFORM_PENDING - 1) * sizeof(WaveBin));
+            acc->nb_pending--;
+        }
+    }
+    acc->pending_index[acc->nb_pending] = acc->bin;
+    acc->pending[acc->nb_pending].min = acc->min;
+    acc->pending[acc->nb_pending].max = acc->max;
+    acc->pending[acc->nb_pending].power = (float)(acc->sumsq / (double)acc->count / (32768.0 * 32768.0));
+    acc->nb_pending++;
+    wave_accum_clear(acc);
+}
+
+//a bin cut short by a seek is kept when it has at least half of its samples
+static void wave_accum_reset(Waveform *wf, WaveAccum *acc, int blocking) {
+    if (acc->pos >= 0 && acc->count > 0 &&
+            acc->count * 2 * WAVEFORM_BIN_RATE >= (int64_t)acc->rate * acc->channels) {
+        wave_accum_push(wf, acc, blocking);
+    }
+    wave_accum_clear(acc);
+    acc->pos = -1;
+}
+
+static void wave_accum_feed(Waveform *wf, WaveAccum *acc, const int16_t *samples, int nb_samples,
+                            int channels, int rate, double pts, int blocking) {
+    int64_t pos = llrint((pts - wf->start_time) * rate);
+
+    if (acc->pos < 0 || acc->rate != rate || acc->channels != channels ||
+            llabs(pos - acc->pos) > rate / WAVEFORM_BIN_RATE) {
+        //the first samples, or a jump: seek, track switch or a gap in the stream
+        wave_accum_reset(wf, acc, blocking);
+        acc->rate = rate;
+        acc->channels = channels;
+        if (pos < 0) {
+            int skip = (int)FFMIN(nb_samples, -pos);
+            samples += skip * channels;
+            nb_samples -= skip;
+            pos += skip;
+        }
+        acc->pos = pos;
+        acc->bin = pos * WAVEFORM_BIN_RATE / rate;
+    }
+    while (nb_samples > 0) {
+        int64_t bin = acc->pos * WAVEFORM_BIN_RATE / rate;
+        int64_t end = ((bin + 1) * rate + WAVEFORM_BIN_RATE - 1) / WAVEFORM_BIN_RATE;
+        int take = (int)FFMIN(nb_samples, end - acc->pos);
+
+        acc->bin = bin;
+        wave_reduce_s16(samples, take * channels, &acc->min, &acc->max, &acc->sumsq);
+        acc->count += take * channels;
+        acc->pos += take;
+        samples += take * channels;
+        nb_samples -= take;
+        if (acc->pos == end) {
+            wave_accum_push(wf, acc, blocking);
+        }
+    }
+    wave_flush(wf, acc, blocking);
+}
+
+/* First empty base bin from index on, -1 when there is none. The lock is taken per
+ * chunk of bins, a long covered stretch does not keep the audio callback out. */
+static int64_t wave_next_missing(Waveform *wf, int64_t index) {
+    int64_t end = FFMIN(wf->end_bin, wf->nb_bins[0]);
+    const WaveBin *bins = wf->levels[0];
+
+    while (index < end) {
+        int64_t chunk_end = FFMIN(end, index + WAVEFORM_SCAN_CHUNK);
+        wave_lock(wf);
+        for (; index < chunk_end; index++) {
+            if (bins[index].min > bins[index].max) {
+                break;
+            }
+        }
+        wave_unlock(wf);
+        if (index < chunk_end) {
+            return index;
+        }
+    }
+    return -1;
+}
+
+static int wave_read(Waveform *wf, const char *path) {
+    WaveHeader header;
+    FILE *in;
+    int ok;
+
+    if (!path[0] || NULL == (in = fopen(path, "rb"))) {
+        return 0;
+    }
+    ok = fread(&header, sizeof(header), 1, in) == 1 &&
+         !memcmp(header.magic, WAVEFORM_MAGIC, sizeof(header.magic)) &&
+         header.file_size == wf->file_size && header.file_mtime == wf->file_mtime &&
+         header.nb_bins == wf->nb_bins[0] && header.stream_index == wf->stream_index &&
+         header.bin_rate == WAVEFORM_BIN_RATE &&
+         fread(wf->levels[0], sizeof(WaveBin), wf->nb_bins[0], in) == (size_t)wf->nb_bins[0];
+    fclose(in);
+    if (!ok) {
+        //stale or foreign, start over
+        int64_t i;
+        for (i = 0; i < wf->nb_bins[0]; i++) {
+            wf->levels[0][i] = wave_merge(NULL, 0);
+        }
+        return 0;
+    }
+    wf->complete = header.complete;
+    wave_rebuild(wf);
+    return 1;
+}
+
+//the sidecar next to the file, else the per user copy
+static int wave_load(Waveform *wf) {
+    return wave_read(wf, wf->sidecar) || wave_read(wf, wf->cached);
+}
+
+//next to the old one and renamed over it, like the probe cache
+static int wave_write(Waveform *wf, const char *path) {
+    WaveHeader header;
+    char tmp[1048];
+    FILE *out;
+    int ok;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, WAVEFORM_MAGIC, sizeof(header.magic));
+    header.file_size = wf->file_size;
+    header.file_mtime = wf->file_mtime;
+    header.nb_bins = wf->nb_bins[0];
+    header.stream_index = wf->stream_index;
+    header.bin_rate = WAVEFORM_BIN_RATE;
+    header.complete = wf->complete;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    out = fopen(tmp, "wb");
+    if (NULL == out) {
+        return 0;
+    }
+    ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+         fwrite(wf->levels[0], sizeof(WaveBin), wf->nb_bins[0], out) == (size_t)wf->nb_bins[0];
+    if (fclose(out) != 0 || !ok || rename(tmp, path) != 0) {
+        remove(tmp);
+        return 0;
+    }
+    return 1;
+}
+
+/* $XDG_CACHE_HOME/tutorial-sdl2-player/waveform/<hash of the real path>.waveform, or
+ * under ~/.cache; empty when there is neither. Created by the first save that needs it. */
+static void wave_cache_path(Waveform *wf, char *path, int size) {
+    const char *base = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+    char real[PATH_MAX], dir[1024];
+    const char *name = realpath(wf->filename, real) ? real : wf->filename;
+    uint64_t hash = 0xcbf29ce484222325ULL; //FNV-1a
+    int len;
+
+    path[0] = '\0';
+    if (base && base[0]) {
+        len = snprintf(dir, sizeof(dir), "%s", base);
+    } else if (home && home[0]) {
+        len = snprintf(dir, sizeof(dir), "%s/.cache", home);
+    } else {
+        return;
+    }
+    if (len <= 0 || len >= (int)sizeof(dir) - 40) {
+        return;
+    }
+    for (; *name; name++) {
+        hash = (hash ^ (uint8_t)*name) * 0x100000001b3ULL;
+    }
+    snprintf(path, size, "%s/tutorial-sdl2-player/waveform/%016"PRIx64".waveform", dir, hash);
+}
+
+//the directories above path, those that exist already are left alone
+static void wave_make_dirs(const char *path) {
+    char dir[1040];
+    char *slash;
+
+    av_strlcpy(dir, path, sizeof(dir));
+    for (slash = strchr(dir + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        mkdir(dir, 0700);
+        *slash = '/';
+    }
+}
+
+//a file in a read only directory gets the per user copy, and is not scanned again
+static void wave_save(Waveform *wf) {
+    if (!wf->sidecar[0] || !wf->dirty) {
+        return;
+    }
+    if (wave_write(wf, wf->sidecar)) {
+        return;
+    }
+    if (wf->cached[0]) {
+        wave_make_dirs(wf->cached);
+    }
+    if (!(wf->cached[0] && wave_write(wf, wf->cached))) {
+        fprintf(stderr, "waveform: could not write %s%s%s\n", wf->sidecar,
+                wf->cached[0] ? " nor " : "", wf->cached);
+    }
+}
+
+static int wave_interrupt_cb(void *opaque) {
+    return ((Waveform *)opaque)->quit;
+}
+
+static int wave_seek(Waveform *wf, AVFormatContext *fmt_ctx, AVCodecContext *codecCtx,
+                     AVStream *st, WaveAccum *acc, int64_t bin) {
+    double time = wf->start_time + (double)bin / WAVEFORM_BIN_RATE;
+
+    wave_accum_reset(wf, acc, 1);
+    if (av_seek_frame(fmt_ctx, st->index, (int64_t)(time / av_q2d(st->time_base)), AVSEEK_FLAG_BACKWARD) < 0) {
+        return -1;
+    }
+    avcodec_flush_buffers(codecCtx);
+    return 0;
+}
+
+/* The background pass: decodes the stream front to back with its own demuxer and jumps
+ * over stretches that playback or an earlier run already filled. Once at the end it
+ * returns to the holes left behind, a few times at most. */
+static int waveform_scan_thread(void *userdata) {
+    Waveform *wf = (Waveform *)userdata;
+    AVFormatContext *fmt_ctx = NULL;
+    AVCodecContext *codecCtx = NULL;
+    struct SwrContext *swr_ctx = NULL;
+    AVFrame *frame = av_frame_alloc();
+    AVPacket packet;
+    AVStream *st;
+    WaveAccum acc;
+    uint8_t *buf = NULL;
+    unsigned int buf_size = 0;
+    int stream_index = wf->stream_index;
+    int64_t start = av_gettime_relative(), in_layout, next, scanned = 0;
+    int64_t check = 0; //bin of the next look ahead
+    int rescans = 0, eof = 0;
+    unsigned int i;
+    int ret;
+
+    //below the playback threads, -thread waveform:... can still change it
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+    thread_sched_enter(THREAD_WAVEFORM);
+    trace_thread_name("waveform");
+    memset(&acc, 0, sizeof(acc));
+    wave_accum_clear(&acc);
+    acc.pos = -1;
+    av_init_packet(&packet);
+    packet.data = NULL;
+    packet.size = 0;
+
+    fmt_ctx = avformat_alloc_context();
+    if (NULL == fmt_ctx || NULL == frame) {
+        goto done;
+    }
+    fmt_ctx->interrupt_callback.callback = wave_interrupt_cb;
+    fmt_ctx->interrupt_callback.opaque = wf;
+    if (avformat_open_input(&fmt_ctx, wf->filename, NULL, NULL) < 0 ||
+            avformat_find_stream_info(fmt_ctx, NULL) < 0 ||
+            open_codec_context(fmt_ctx, &stream_index, &codecCtx, AVMEDIA_TYPE_AUDIO) < 0) {
+        goto done;
+    }
+    for (i = 0; i < fmt_ctx->nb_streams; i++) {
+        fmt_ctx->streams[i]->discard = (int)i == stream_index ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+    }
+    st = fmt_ctx->streams[stream_index];
+    //s16 at the stream's own rate and layout, a format conversion only
+    in_layout = codecCtx->channel_layout ? codecCtx->channel_layout : av_get_default_channel_layout(codecCtx->channels);
+    swr_ctx = swr_alloc_set_opts(NULL, in_layout, AV_SAMPLE_FMT_S16, codecCtx->sample_rate,
+                                 in_layout, codecCtx->sample_fmt, codecCtx->sample_rate, 0, NULL);
+    if (NULL == swr_ctx || swr_init(swr_ctx) < 0) {
+        goto done;
+    }
+
+    while (!wf->quit) {
+        if (eof) {
+            //back to the holes left behind
+            wave_accum_reset(wf, &acc, 1);
+            next = wave_next_missing(wf, 0);
+            if (next < 0) {
+                wf->complete = 1;
+                break;
+            }
+            if (++rescans > WAVEFORM_RESCANS || wave_seek(wf, fmt_ctx, codecCtx, st, &acc, next) < 0) {
+                break;
+            }
+            eof = 0;
+            check = next + WAVEFORM_BIN_RATE;
+        } else if (acc.pos >= 0 && acc.pos * WAVEFORM_BIN_RATE / acc.rate >= check) {
+            //once a second, is the stretch ahead already covered
+            int64_t bin = acc.pos * WAVEFORM_BIN_RATE / acc.rate;
+            next = wave_next_missing(wf, bin);
+            if (next < 0) {
+                eof = 1;
+                continue;
+            }
+            if (next - bin > WAVEFORM_SEEK_GAP) {
+                if (wave_seek(wf, fmt_ctx, codecCtx, st, &acc, next) < 0) {
+                    break;
+                }
+                bin = next;
+            }
+            check = bin + WAVEFORM_BIN_RATE;
+        }
+
+        trace_begin("waveform_read");
+        ret = av_read_frame(fmt_ctx, &packet);
+        trace_end("waveform_read");
+        if (ret < 0) {
+            if (ret != AVERROR_EOF && fmt_ctx->pb && fmt_ctx->pb->error) {
+                break;
+            }
+            //drain the decoder, then close what is known to exist
+            avcodec_send_packet(codecCtx, NULL);
+            eof = 1;
+        } else if (packet.stream_index != stream_index) {
+            av_packet_unref(&packet);
+            continue;
+        } else {
+            avcodec_send_packet(codecCtx, &packet);
+            av_packet_unref(&packet);
+        }
+
+        while (avcodec_receive_frame(codecCtx, frame) == 0) {
+            int nb_samples;
+            double pts;
+
+            av_fast_malloc(&buf, &buf_size, frame->nb_samples * codecCtx->channels * sizeof(int16_t));
+            if (NULL == buf) {
+                goto done;
+            }
+            nb_samples = swr_convert(swr_ctx, &buf, frame->nb_samples, (const uint8_t **)frame->extended_data, frame->nb_samples);
+            if (nb_samples <= 0) {
+                continue;
+            }
+            if (frame->best_effort_timestamp != AV_NOPTS_VALUE) {
+                pts = frame->best_effort_timestamp * av_q2d(st->time_base);
+            } else if (acc.pos >= 0) {
+                pts = wf->start_time + (double)acc.pos / acc.rate;
+            } else {
+                continue;
+            }
+            trace_begin("waveform_reduce");
+            wave_accum_feed(wf, &acc, (const int16_t *)buf, nb_samples, codecCtx->channels, codecCtx->sample_rate, pts, 1);
+            trace_end("waveform_reduce");
+            scanned += nb_samples;
+        }
+        if (eof) {
+            if (acc.pos >= 0) {
+                wf->end_bin = FFMIN(wf->end_bin, acc.pos * WAVEFORM_BIN_RATE / acc.rate + 1);
+            }
+            wave_accum_reset(wf, &acc, 1);
+            avcodec_flush_buffers(codecCtx);
+        }
+    }
+    wave_accum_reset(wf, &acc, 1);
+    wave_flush(wf, &acc, 1);
+    if (scanned > 0) {
+        double elapsed = (av_gettime_relative() - start) / 1000000.0;
+        double seconds = (double)scanned / codecCtx->sample_rate;
+        fprintf(stderr, "waveform: scanned %.1f s of audio in %.2f s (%.0fx realtime)%s\n",
+                seconds, elapsed, elapsed > 0 ? seconds / elapsed : 0, wf->complete ? ", complete" : "");
+    }
+
+    done:
+        av_free(buf);
+        swr_free(&swr_ctx);
+        av_frame_free(&frame);
+        avcodec_free_context(&codecCtx);
+        if (fmt_ctx) {
+            avformat_close_input(&fmt_ctx);
+        }
+    return 0;
+}
+
+Waveform *waveform_open(const char *filename, AVFormatContext *fmt_ctx, int stream_index) {
+    AVStream *st = fmt_ctx->streams[stream_index];
+    Waveform *wf;
+    struct stat sb;
+    double duration = 0;
+    int64_t nb_bins;
+    int level, loaded;
+
+    if (st->duration != AV_NOPTS_VALUE) {
+        duration = st->duration * av_q2d(st->time_base);
+    } else if (fmt_ctx->duration != AV_NOPTS_VALUE) {
+        duration = fmt_ctx->duration / (double)AV_TIME_BASE;
+    }
+    if (duration <= 0) {
+        fprintf(stderr, "waveform: unknown duration, no overview\n");
+        return NULL;
+    }
+    wf = av_mallocz(sizeof(Waveform));
+    if (NULL == wf) {
+        return NULL;
+    }
+    av_strlcpy(wf->filename, filename, sizeof(wf->filename));
+    wf->stream_index = stream_index;
+    wf->start_time = st->start_time != AV_NOPTS_VALUE ? st->start_time * av_q2d(st->time_base) : 0;
+    wf->duration = duration;
+    wf->play.pos = -1;
+    wave_accum_clear(&wf->play);
+    wf->mutex = SDL_CreateMutex();
+    if (NULL == wf->mutex) {
+        waveform_close(&wf);
+        return NULL;
+    }
+
+    nb_bins = (int64_t)ceil(duration * WAVEFORM_BIN_RATE) + 1;
+    wf->end_bin = nb_bins;
+    for (level = 0; level < WAVEFORM_MAX_LEVELS; level++) {
+        int64_t i;
+        wf->nb_bins[level] = nb_bins;
+        wf->levels[level] = av_malloc_array(nb_bins, sizeof(WaveBin));
+        if (NULL == wf->levels[level]) {
+            waveform_close(&wf);
+            return NULL;
+        }
+        wf->levels_size += nb_bins * sizeof(WaveBin);
+        mem_budget_add(MEM_WAVEFORM, nb_bins * sizeof(WaveBin));
+        for (i = 0; i < nb_bins; i++) {
+            wf->levels[level][i] = wave_merge(NULL, 0);
+        }
+        wf->nb_levels++;
+        if (nb_bins == 1) {
+            break;
+        }
+        nb_bins = (nb_bins + WAVEFORM_FANOUT - 1) / WAVEFORM_FANOUT;
+    }
+
+    //only local files get a sidecar, keyed like the probe cache
+    if (stat(filename, &sb) == 0 && S_ISREG(sb.st_mode)) {
+        wf->file_size = sb.st_size;
+#ifdef __linux__
+        wf->file_mtime = sb.st_mtim.tv_sec * 1000000000LL + sb.st_mtim.tv_nsec;
+#else
+        wf->file_mtime = sb.st_mtime * 1000000000LL;
+#endif
+        snprintf(wf->sidecar, sizeof(wf->sidecar), "%s.waveform", filename);
+        wave_cache_path(wf, wf->cached, sizeof(wf->cached));
+    }
+    loaded = wave_load(wf);
+    if (!wf->complete) {
+        wf->scan_tid = SDL_CreateThread(waveform_scan_thread, "waveform", wf);
+    }
+    fprintf(stderr, "waveform: %.0f s in %"PRId64" bins, %d levels%s%s\n", duration, wf->nb_bins[0], wf->nb_levels,
+            loaded ? ", read from the sidecar" : "", wf->scan_tid ? ", scanning in the background" : "");
+    return wf;
+}
+
+void waveform_feed(Waveform *wf, int stream_index, const int16_t *samples, int nb_samples,
+                   int channels, int sample_rate, double pts) {
+    if (stream_index != wf->stream_index || nb_samples <= 0) {
+        return;
+    }
+    wave_accum_feed(wf, &wf->play, samples, nb_samples, channels, sample_rate, pts, 0);
+}
+
+void waveform_draw(Waveform *wf, SDL_Renderer *renderer, const SDL_Rect *rect, double position) {
+    const WaveBin *bins;
+    SDL_Rect *peaks, *rms;
+    int64_t start = av_gettime_relative(), nb_bins, elapsed;
+    int level = 0, nb_columns = 0, half = rect->h / 2, mid = rect->y + rect->h / 2;
+    int x;
+
+    if (rect->w <= 0 || rect->h <= 0) {
+        return;
+    }
+    if (rect->w > wf->nb_rects_alloc) {
+        SDL_Rect *rects = av_realloc_array(wf->rects, 2 * rect->w, sizeof(SDL_Rect));
+        if (NULL == rects) {
+            return;
+        }
+        wf->rects = rects;
+        wf->nb_rects_alloc = rect->w;
+    }
+    peaks = wf->rects;
+    rms = wf->rects + rect->w;
+
+    //the finest level with at most FANOUT bins per column
+    while (level + 1 < wf->nb_levels && wf->nb_bins[level] > (int64_t)WAVEFORM_FANOUT * rect->w) {
+        level++;
+    }
+    bins = wf->levels[level];
+    nb_bins = wf->nb_bins[level];
+
+    wave_lock(wf);
+    for (x = 0; x < rect->w; x++) {
+        int64_t first = x * nb_bins / rect->w;
+        int64_t last = FFMAX(first + 1, (x + 1) * nb_bins / rect->w);
+        WaveBin bin = wave_merge(bins + first, last - first);
+        int r;
+
+        if (bin.min > bin.max) {
+            continue;
+        }
+        peaks[nb_columns].x = rect->x + x;
+        peaks[nb_columns].y = mid - bin.max * half / 32768;
+        peaks[nb_columns].w = 1;
+        peaks[nb_columns].h = (bin.max - bin.min) * half / 32768 + 1;
+        r = (int)(sqrtf(bin.power) * half);
+        rms[nb_columns].x = rect->x + x;
+        rms[nb_columns].y = mid - r;
+        rms[nb_columns].w = 1;
+        rms[nb_columns].h = 2 * r + 1;
+        nb_columns++;
+    }
+    wave_unlock(wf);
+
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 160);
+    SDL_RenderFillRect(renderer, rect);
+    SDL_SetRenderDrawColor(renderer, 70, 120, 190, 255);
+    SDL_RenderFillRects(renderer, peaks, nb_columns);
+    SDL_SetRenderDrawColor(renderer, 160, 200, 250, 255);
+    SDL_RenderFillRects(renderer, rms, nb_columns);
+    x = rect->x + (int)((position - wf->start_time) / wf->duration * rect->w);
+    x = av_clip(x, rect->x, rect->x + rect->w - 1);
+    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+    SDL_RenderDrawLine(renderer, x, rect->y, x, rect->y + rect->h - 1);
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+
+    elapsed = av_gettime_relative() - start;
+    wf->draws++;
+    wf->draw_time_max = FFMAX(wf->draw_time_max, elapsed);
+}
+
+double waveform_time_at(Waveform *wf, const SDL_Rect *rect, int x) {
+    double frac = rect->w > 0 ? (double)(x - rect->x) / rect->w : 0;
+    return wf->start_time + av_clipd(frac, 0, 1) * wf->duration;
+}
+
+void waveform_close(Waveform **pwf) {
+    Waveform *wf = *pwf;
+    int level;
+
+    if (NULL == wf) {
+        return;
+    }
+    wf->quit = 1;
+    if (wf->scan_tid) {
+        SDL_WaitThread(wf->scan_tid, NULL);
+    }
+    //the audio device is closed, nothing feeds the playback side any more
+    wave_flush(wf, &wf->play, 1);
+    wave_save(wf);
+    if (wf->draws) {
+        fprintf(stderr, "waveform: %"PRId64" draws, %.2f ms max\n", wf->draws, wf->draw_time_max / 1000.0);
+    }
+    for (level = 0; level < WAVEFORM_MAX_LEVELS; level++) {
+        av_free(wf->levels[level]);
+    }
+    mem_budget_sub(MEM_WAVEFORM, wf->levels_size);
+    if (wf->mutex) {
+        SDL_DestroyMutex(wf->mutex);
+    }
+    av_free(wf->rects);
+    av_freep(pwf);
+}
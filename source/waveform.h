@@ -0,0 +1,44 @@
+#ifndef WAVEFORM_H
+#define WAVEFORM_H
+
+#include <stdint.h>
+#include <SDL2/SDL.h>
+#include <libavformat/avformat.h>
+
+/* Waveform overview of an audio stream, drawn over the bottom of the window for seeking.
+ *
+ * The stream is cut into bins of 10 ms, each with the minimum, maximum and mean power of its
+ * samples, all channels together. Above them every level merges 4 bins of the one below,
+ * up to a single bin, so drawing reads at most 4 bins per pixel column whatever the length
+ * of the file.
+ *
+ * Bins are filled from two sides: the samples the audio callback plays, and a background
+ * thread with its own demuxer and decoder that runs over the rest of the file at low
+ * priority, skipping what playback already covered. The audio callback never waits for the
+ * lock, bins it can not store at once are kept until the next callback.
+ *
+ * The base bins are saved next to the file as <file>.waveform, keyed by its size and
+ * modification time, so a file is scanned once. */
+#define WAVEFORM_BIN_RATE 100 //bins per second
+#define WAVEFORM_FANOUT 4
+#define WAVEFORM_MAX_LEVELS 16
+
+typedef struct Waveform Waveform;
+
+//NULL without a known duration
+Waveform *waveform_open(const char *filename, AVFormatContext *fmt_ctx, int stream_index);
+
+//audio callback; interleaved s16 starting at pts seconds, other streams than the opened one are ignored
+void waveform_feed(Waveform *wf, int stream_index, const int16_t *samples, int nb_samples,
+                   int channels, int sample_rate, double pts);
+
+//main thread; the overview of the whole stream into rect, with a line at position seconds
+void waveform_draw(Waveform *wf, SDL_Renderer *renderer, const SDL_Rect *rect, double position);
+
+//the stream time, in seconds, under column x of rect
+double waveform_time_at(Waveform *wf, const SDL_Rect *rect, int x);
+
+//stops the background pass and saves the bins, after the audio device is closed
+void waveform_close(Waveform **wf);
+
+#endif